@@ -0,0 +1,266 @@
+#include "ohcli.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#if defined(__GNUC__) && !defined(__clang__)
+// GCC sees through the replacement below and takes malloc()/free() for a mismatch.
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+// Counts every global allocation, so the report can show allocations per parse.
+static std::size_t allocations = 0;
+
+void *operator new(std::size_t size)
+{
+  ++allocations;
+  if (void *p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+
+class Argv
+{
+private:
+  std::vector<std::string> words;
+  std::vector<char *> ptrs;
+public:
+  Argv() { add("bench"); }
+
+  Argv &add(std::string word)
+  {
+    words.emplace_back(std::move(word));
+    return *this;
+  }
+
+  int argc() const { return static_cast<int>(words.size()); }
+
+  char **argv()
+  {
+    ptrs.clear();
+    for (auto &r: words)
+      ptrs.emplace_back(r.data());
+    ptrs.emplace_back(nullptr);
+    return ptrs.data();
+  }
+};
+
+// Runs parse() + run() 'iterations' times after one warm-up round.
+template<typename Run = void (*)(ohcli::CLI &)>
+void bench(const char *name, ohcli::CLI &cli, Argv &args, std::size_t iterations,
+           Run run = [](ohcli::CLI &c) { c.run(); })
+{
+  int argc = args.argc();
+  char **argv = args.argv();
+  cli.parse(argc, argv);
+  run(cli);
+  cli.reset();
+  std::size_t before = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+  {
+    cli.parse(argc, argv);
+    run(cli);
+    cli.reset();
+  }
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  auto tokens = static_cast<double>(iterations) * (argc - 1);
+  std::printf("%-28s %10d %12.2f %14.2f\n", name, argc - 1, ns / tokens,
+              static_cast<double>(allocations - before) / static_cast<double>(iterations));
+}
+
+static void many_options(std::size_t n, std::size_t iterations)
+{
+  ohcli::CLI cli;
+  Argv args;
+  std::vector<int> values(n);
+  std::unique_ptr<bool[]> flags(new bool[n]());
+  std::size_t calls = 0;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    auto name = "opt" + std::to_string(i);
+    switch (i % 3)
+    {
+      case 0:
+        cli.add_value(name, values[i]);
+        args.add("--" + name).add(std::to_string(i));
+        break;
+      case 1:
+        cli.add_option(name, flags[i]);
+        args.add("--" + name);
+        break;
+      case 2:
+        cli.add_cmd(name, ohcli::SpanCmd([&calls](ohcli::ArgSpan a) { calls += a.size(); }));
+        args.add("--" + name).add("a").add("b");
+        break;
+    }
+  }
+  auto label = "options/" + std::to_string(n);
+  bench(label.c_str(), cli, args, iterations);
+}
+
+static void positionals(std::size_t n, std::size_t iterations)
+{
+  ohcli::CLI cli;
+  Argv args;
+  std::size_t count = 0;
+  cli.add_cmd("p", ohcli::SpanCmd([&count](ohcli::ArgSpan a) { count += a.size(); }));
+  args.add("-p");
+  for (std::size_t i = 0; i < n; ++i)
+    args.add("file" + std::to_string(i));
+  bench("positionals", cli, args, iterations);
+}
+
+static void bundles(std::size_t n, std::size_t iterations)
+{
+  ohcli::CLI cli;
+  Argv args;
+  bool flags[26] = {};
+  std::string all;
+  for (int i = 0; i < 26; ++i)
+  {
+    all += static_cast<char>('a' + i);
+    cli.add_option(std::string(1, static_cast<char>('a' + i)), flags[i]);
+  }
+  for (std::size_t i = 0; i < n; ++i)
+    args.add("-" + all);
+  bench("short-flag bundles", cli, args, iterations);
+}
+
+static void emails(std::size_t n, std::size_t iterations)
+{
+  ohcli::CLI cli;
+  Argv args;
+  std::string email;
+  cli.add_value("s", email, ohcli::email());
+  for (std::size_t i = 0; i < n; ++i)
+    args.add("-s").add("user" + std::to_string(i) + "@example.com");
+  bench("email()", cli, args, iterations);
+}
+
+static void invalid_numbers(std::size_t iterations)
+{
+  ohcli::CLI cli;
+  Argv args;
+  int value = 0;
+  std::size_t rejected = 0;
+  cli.add_value("n", value);
+  args.add("-n").add("12x4");
+  bench("invalid number", cli, args, iterations, [&rejected](ohcli::CLI &c)
+  {
+    try
+    {
+      c.run();
+    }
+    catch (std::runtime_error &)
+    {
+      ++rejected;
+    }
+  });
+}
+
+// parse_batch() over 'n' recorded command lines; allocations are reported per row.
+static void batch(std::size_t n, std::size_t iterations)
+{
+  ohcli::CLI cli;
+  int level = 0;
+  bool verbose = false;
+  std::string name;
+  cli.add_value("level", level).add_option("verbose", "v", verbose).add_value("name", name);
+  std::vector<std::vector<std::string>> rows;
+  for (std::size_t i = 0; i < n; ++i)
+    rows.push_back({"bench", "--level", std::to_string(i % 10), "-v", "--name=user" + std::to_string(i)});
+  ohcli::Batch result;
+  result.add_column<int>("level");
+  result.add_column<std::string>("name");
+  result.add_flag("verbose");
+  cli.parse_batch(rows, result);
+  std::size_t before = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+    cli.parse_batch(rows, result);
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  auto tokens = static_cast<double>(iterations * n) * 4;
+  std::printf("%-28s %10zu %12.2f %14.2f\n", "parse_batch", n * 4, ns / tokens,
+              static_cast<double>(allocations - before) / static_cast<double>(iterations * n));
+}
+
+// The conversions alone, without parsing: 'convert' is called on each of 'words' in turn.
+// Allocations are reported per word.
+template<typename Word, typename Convert>
+static void conversions(const char *name, const std::vector<Word> &words, std::size_t iterations, Convert convert)
+{
+  double sink = 0;
+  for (auto &r: words)
+    sink += convert(r);
+  std::size_t before = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < iterations; ++i)
+  {
+    for (auto &r: words)
+      sink += convert(r);
+  }
+  auto ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  auto count = static_cast<double>(iterations * words.size());
+  // Keeps the results observable, so the loop isn't optimized away.
+  volatile double keep = sink;
+  (void) keep;
+  std::printf("%-28s %10zu %12.2f %14.2f\n", name, words.size(), ns / count,
+              static_cast<double>(allocations - before) / count);
+}
+
+static void conversions(std::size_t n, std::size_t iterations)
+{
+  std::vector<std::string> ints;
+  std::vector<std::string> doubles;
+  for (std::size_t i = 0; i < n; ++i)
+  {
+    ints.emplace_back(std::to_string(static_cast<long long>(i * 7919) - 500000));
+    doubles.emplace_back(std::to_string(static_cast<double>(i) / 7.0));
+  }
+  std::vector<std::string_view> int_views(ints.cbegin(), ints.cend());
+  std::vector<std::string_view> double_views(doubles.cbegin(), doubles.cend());
+  conversions("from_str<int>", int_views, iterations, [](std::string_view w)
+  {
+    int v = 0;
+    ohcli::utils::from_str(w, v);
+    return v;
+  });
+  conversions("from_str<double>", double_views, iterations, [](std::string_view w)
+  {
+    double v = 0;
+    ohcli::utils::from_str(w, v);
+    return v;
+  });
+  conversions("str_to<int>", ints, iterations, [](const std::string &w) { return ohcli::utils::str_to<int>(w); });
+  conversions("str_to<double>", doubles, iterations,
+              [](const std::string &w) { return ohcli::utils::str_to<double>(w); });
+}
+
+int main(int argc, char **argv)
+{
+  // An optional scale for the iteration counts, e.g. 0.1 for a quick run.
+  double scale = argc > 1 ? std::atof(argv[1]) : 1.0;
+  auto iters = [scale](double n) { return static_cast<std::size_t>(n * scale) + 1; };
+  std::printf("%-28s %10s %12s %14s\n", "workload", "tokens", "ns/token", "allocs/parse");
+  for (std::size_t n: {10, 100, 1000, 10000})
+    many_options(n, iters(2e5 / static_cast<double>(n)));
+  positionals(100000, iters(20));
+  bundles(1000, iters(200));
+  emails(1000, iters(50));
+  invalid_numbers(iters(1e4));
+  batch(10000, iters(20));
+  conversions(10000, iters(200));
+  return 0;
+}
@@ -0,0 +1,405 @@
+//   Copyright 2022 ohcli - caozhanhao
+//
+//   Licensed under the Apache License, Version 2.0 (the "License");
+//   you may not use this file except in compliance with the License.
+//   You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+//   Unless required by applicable law or agreed to in writing, software
+//   distributed under the License is distributed on an "AS IS" BASIS,
+//   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//   See the License for the specific language governing permissions and
+//   limitations under the License.
+#include "ohcli.h"
+#include <regex>
+#include <iostream>
+#include <filesystem>
+#ifdef OHCLI_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace ohcli
+{
+  namespace utils
+  {
+    OHCLI_INLINE void fatal(const std::string &str)
+    {
+      throw std::logic_error("\033[31mFATAL: \033[0m" + str);
+    }
+    
+    OHCLI_INLINE void error(const std::string &str)
+    {
+      throw std::runtime_error("\033[31mERROR: \033[0m" + str);
+    }
+    
+    OHCLI_INLINE void warn(const std::string &str)
+    {
+      std::cout << "\033[33mWARNING: \033[0m" << str << std::endl;
+    }
+    
+    template<typename Read>
+    bool MappedFile::read_all(Read &&read)
+    {
+      std::size_t used = 0;
+      for (;;)
+      {
+        if (used == buffer.size())
+          buffer.resize(buffer.empty() ? 64 * 1024 : buffer.size() * 2);
+        auto n = read(buffer.data() + used, buffer.size() - used);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n < 0)
+          return false;
+        if (n == 0)
+          break;
+        used += static_cast<std::size_t>(n);
+      }
+      buffer.resize(used);
+      ptr = buffer.data();
+      len = used;
+      return true;
+    }
+    
+    OHCLI_INLINE bool MappedFile::open(const std::string &path)
+    {
+      close();
+#ifdef OHCLI_POSIX
+      int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        return false;
+      bool ok = open(fd);
+      ::close(fd);
+      return ok;
+#else
+      std::FILE *fp = std::fopen(path.c_str(), "rb");
+      if (fp == nullptr)
+        return false;
+      file_id = {0, std::hash<std::string>()(path)};
+      bool ok = read_all([fp](char *buf, std::size_t size) -> std::ptrdiff_t
+                         {
+                           auto n = std::fread(buf, 1, size, fp);
+                           return std::ferror(fp) ? -1 : static_cast<std::ptrdiff_t>(n);
+                         });
+      std::fclose(fp);
+      return ok;
+#endif
+    }
+    
+#ifdef OHCLI_POSIX
+    
+    OHCLI_INLINE bool MappedFile::open(int fd)
+    {
+      close();
+      struct stat st{};
+      if (::fstat(fd, &st) != 0 || S_ISDIR(st.st_mode))
+        return false;
+      file_id = {static_cast<std::uint64_t>(st.st_dev), static_cast<std::uint64_t>(st.st_ino)};
+      if (S_ISREG(st.st_mode) && st.st_size > 0)
+      {
+        void *addr = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED)
+        {
+          ptr = static_cast<char *>(addr);
+          len = static_cast<std::size_t>(st.st_size);
+          mapped = true;
+          return true;
+        }
+      }
+      return read_all([fd](char *buf, std::size_t size) -> std::ptrdiff_t { return ::read(fd, buf, size); });
+    }
+#endif
+    
+    OHCLI_INLINE void MappedFile::close()
+    {
+#ifdef OHCLI_POSIX
+      if (mapped)
+        ::munmap(ptr, len);
+#endif
+      ptr = nullptr;
+      len = 0;
+      mapped = false;
+      buffer.clear();
+    }
+    
+    OHCLI_INLINE std::size_t edit_distance(const std::array<std::uint64_t, 256> &peq, std::size_t m,
+                                           std::string_view text, std::size_t limit)
+    {
+      const std::uint64_t high = std::uint64_t(1) << (m - 1);
+      std::uint64_t pv = m == 64 ? ~std::uint64_t(0) : (std::uint64_t(1) << m) - 1;
+      std::uint64_t mv = 0;
+      std::size_t score = m;
+      if (score > limit + text.size())
+        return limit + 1;
+      for (std::size_t j = 0; j < text.size(); ++j)
+      {
+        std::uint64_t eq = peq[static_cast<unsigned char>(text[j])];
+        std::uint64_t xv = eq | mv;
+        std::uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        std::uint64_t ph = mv | ~(xh | pv);
+        std::uint64_t mh = pv & xh;
+        if (ph & high)
+          ++score;
+        else if (mh & high)
+          --score;
+        // The score drops by at most one per remaining character.
+        if (score > limit + (text.size() - j - 1))
+          return limit + 1;
+        ph = (ph << 1) | 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+      }
+      return score;
+    }
+    
+    OHCLI_INLINE bool ConfigFile::open(const std::string &path, const std::string &cache)
+    {
+      std::error_code ec;
+      auto size = std::filesystem::file_size(path, ec);
+      if (ec)
+        return false;
+      auto mtime = std::filesystem::last_write_time(path, ec).time_since_epoch().count();
+      if (ec)
+        return false;
+      if (!cache.empty() && load(cache, path, size, static_cast<std::int64_t>(mtime)))
+        return true;
+      if (!parse(path))
+        return false;
+      if (!cache.empty())
+        store(cache, path, size, static_cast<std::int64_t>(mtime));
+      return true;
+    }
+    
+    OHCLI_INLINE bool ConfigFile::parse(const std::string &path)
+    {
+      clear();
+      if (!file.open(path))
+        return false;
+      char *first = file.data();
+      char *last = first + file.size();
+      std::string_view section;
+      while (first != last)
+      {
+        char *end = const_cast<char *>(find_char(first, last, '\n'));
+        char *next = end == last ? last : end + 1;
+        auto line = trim(std::string_view(first, static_cast<std::size_t>(end - first)));
+        if (line.empty() || line[0] == '#' || line[0] == ';')
+        {
+          first = next;
+          continue;
+        }
+        if (line.front() == '[' && line.back() == ']')
+        {
+          section = trim(line.substr(1, line.size() - 2));
+          first = next;
+          continue;
+        }
+        auto eq = line.find('=');
+        auto key = trim(line.substr(0, eq));
+        if (!section.empty())
+          key = names.emplace_back(std::string(section) + "." + std::string(key));
+        auto begin = static_cast<std::uint32_t>(words.size());
+        if (eq != std::string_view::npos)
+        {
+          char *value = first + (line.data() - first) + eq + 1;
+          split_words(value, value + (line.size() - eq - 1), [this](std::string_view w) { words.emplace_back(w); });
+        }
+        entries.push_back({key, begin, static_cast<std::uint32_t>(words.size()) - begin});
+        first = next;
+      }
+      return true;
+    }
+    
+    OHCLI_INLINE bool ConfigFile::load(const std::string &cache, const std::string &path, std::uint64_t size,
+                                       std::int64_t mtime)
+    {
+      clear();
+      if (!file.open(cache) || file.size() < sizeof(Header))
+        return false;
+      Header h;
+      std::memcpy(&h, file.data(), sizeof(Header));
+      // Counted in 64 bits, so forged counts can't wrap around and pass the size check that
+      // comes before anything is reserved or read for them.
+      std::uint64_t tables = sizeof(Header)
+                             + (std::uint64_t(h.entries) * 4 + std::uint64_t(h.words) * 2) * sizeof(std::uint32_t);
+      if (h.magic != magic || h.version != version || h.size != size || h.mtime != mtime
+          || file.size() < tables || file.size() - tables != h.blob || h.path > h.blob
+          || std::string_view(file.data() + tables, h.path) != path)
+      {
+        clear();
+        return false;
+      }
+      const char *blob = file.data() + tables;
+      auto span = [&](const char *at) -> std::optional<std::string_view>
+      {
+        Span s;
+        std::memcpy(&s, at, sizeof(Span));
+        if (s.offset > h.blob || s.size > h.blob - s.offset)
+          return std::nullopt;
+        return std::string_view(blob + s.offset, s.size);
+      };
+      const char *at = file.data() + sizeof(Header);
+      entries.reserve(h.entries);
+      for (std::uint32_t i = 0; i < h.entries; ++i, at += 4 * sizeof(std::uint32_t))
+      {
+        auto key = span(at);
+        std::uint32_t range[2];
+        std::memcpy(range, at + sizeof(Span), sizeof(range));
+        if (!key || range[0] > h.words || range[1] > h.words - range[0])
+        {
+          clear();
+          return false;
+        }
+        entries.push_back({*key, range[0], range[1]});
+      }
+      words.reserve(h.words);
+      for (std::uint32_t i = 0; i < h.words; ++i, at += sizeof(Span))
+      {
+        auto w = span(at);
+        if (!w)
+        {
+          clear();
+          return false;
+        }
+        words.emplace_back(*w);
+      }
+      return true;
+    }
+    
+    OHCLI_INLINE void ConfigFile::store(const std::string &cache, const std::string &path, std::uint64_t size,
+                                        std::int64_t mtime) const
+    {
+      std::string blob(path);
+      std::vector<std::uint32_t> tables;
+      tables.reserve(entries.size() * 4 + words.size() * 2);
+      auto add = [&](std::string_view s)
+      {
+        tables.emplace_back(static_cast<std::uint32_t>(blob.size()));
+        tables.emplace_back(static_cast<std::uint32_t>(s.size()));
+        blob += s;
+      };
+      for (auto &r: entries)
+      {
+        add(r.key);
+        tables.emplace_back(r.first);
+        tables.emplace_back(r.count);
+      }
+      for (auto &r: words)
+        add(r);
+      Header h{magic, version, size, mtime, static_cast<std::uint32_t>(path.size()),
+               static_cast<std::uint32_t>(entries.size()), static_cast<std::uint32_t>(words.size()),
+               static_cast<std::uint32_t>(blob.size())};
+      // Written aside and renamed, so a concurrent start never maps a partial cache.
+      std::string temp = cache + ".tmp";
+      std::FILE *fp = std::fopen(temp.c_str(), "wb");
+      if (fp == nullptr)
+        return;
+      bool ok = std::fwrite(&h, sizeof(h), 1, fp) == 1
+                && std::fwrite(tables.data(), sizeof(std::uint32_t), tables.size(), fp) == tables.size()
+                && std::fwrite(blob.data(), 1, blob.size(), fp) == blob.size();
+      ok = std::fclose(fp) == 0 && ok;
+      if (!ok || std::rename(temp.c_str(), cache.c_str()) != 0)
+        std::remove(temp.c_str());
+    }
+    
+    struct CompiledRegex
+    {
+      std::regex re;
+    };
+    
+    OHCLI_INLINE std::regex_constants::syntax_option_type regex_options(RegexFlags flags)
+    {
+      namespace rc = std::regex_constants;
+      rc::syntax_option_type r = rc::ECMAScript;
+      if (flags & RegexFlags::basic)
+        r = rc::basic;
+      else if (flags & RegexFlags::extended)
+        r = rc::extended;
+      else if (flags & RegexFlags::awk)
+        r = rc::awk;
+      else if (flags & RegexFlags::grep)
+        r = rc::grep;
+      else if (flags & RegexFlags::egrep)
+        r = rc::egrep;
+      if (flags & RegexFlags::icase)
+        r |= rc::icase;
+      if (flags & RegexFlags::nosubs)
+        r |= rc::nosubs;
+      if (flags & RegexFlags::optimize)
+        r |= rc::optimize;
+      if (flags & RegexFlags::collate)
+        r |= rc::collate;
+      return r;
+    }
+    
+    OHCLI_INLINE std::shared_ptr<const CompiledRegex> compile_regex(const std::string &pattern, RegexFlags flags)
+    {
+      static std::mutex mutex;
+      static std::map<std::pair<std::string, RegexFlags>, std::shared_ptr<const CompiledRegex>> cache;
+      std::lock_guard<std::mutex> lock(mutex);
+      Probe probe(regex_observer.load(std::memory_order_acquire));
+      auto it = cache.find({pattern, flags});
+      if (it != cache.end())
+      {
+        probe.lap([&](Observer &o, std::chrono::nanoseconds t) { o.on_regex_compile(pattern, t, true); });
+        return it->second;
+      }
+      struct Report
+      {
+        Probe &probe;
+        const std::string &pattern;
+        
+        ~Report() { probe.lap([this](Observer &o, std::chrono::nanoseconds t) { o.on_regex_compile(pattern, t, false); }); }
+      } report{probe, pattern};
+      std::shared_ptr<const CompiledRegex> compiled;
+      try
+      {
+        compiled = std::make_shared<const CompiledRegex>(CompiledRegex{std::regex(pattern, regex_options(flags))});
+      }
+      catch (std::regex_error &e)
+      {
+        fatal("Invalid regex '" + pattern + "': " + e.what());
+      }
+      cache.emplace(std::make_pair(pattern, flags), compiled);
+      return compiled;
+    }
+#ifndef OHCLI_HEADER_ONLY
+    
+#define OHCLI_CONVERSION(T) \
+    template std::errc from_str<T>(std::string_view, T &); \
+    template T convert<T>(std::string_view);
+    OHCLI_EXPLICIT_TYPES(OHCLI_CONVERSION)
+#undef OHCLI_CONVERSION
+#endif
+  }
+  
+  OHCLI_INLINE bool Regex::operator()(const std::string &v) const
+  {
+    utils::Probe probe(utils::regex_observer.load(std::memory_order_acquire));
+    bool matched = std::regex_match(v, compiled->re);
+    probe.lap([matched](Observer &o, std::chrono::nanoseconds t) { o.on_regex_match(t, matched); });
+    return matched;
+  }
+  
+  OHCLI_INLINE Regex regex(const std::string &pattern, utils::RegexFlags flags)
+  {
+    return Regex(utils::compile_regex(pattern, flags));
+  }
+  
+  OHCLI_INLINE Regex email()
+  {
+    return regex("^\\w+([-+.]\\w+)*@\\w+([-.]\\w+)*\\.\\w+([-.]\\w+)*$");
+  }
+#ifndef OHCLI_HEADER_ONLY
+  
+#define OHCLI_ADD_VALUE(T) \
+  template CLI &CLI::add_value<T, utils::Unrestricted, void>(const std::string &, T &, utils::Unrestricted); \
+  template CLI &CLI::add_value<T, utils::Unrestricted, void>( \
+      const std::string &, const std::string &, T &, utils::Unrestricted);
+  OHCLI_EXPLICIT_TYPES(OHCLI_ADD_VALUE)
+#undef OHCLI_ADD_VALUE
+#endif
+}
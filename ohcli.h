@@ -13,65 +13,303 @@
 //   limitations under the License.
 #ifndef OHCLI_OPTION_H
 #define OHCLI_OPTION_H
-#include "err.h"
 #include <vector>
 #include <functional>
-#include <regex>
 #include <map>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <algorithm>
+#include <charconv>
+#include <limits>
+#include <array>
+#include <cstdint>
 #include <cstring>
-#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <deque>
+#include <istream>
+#include <iterator>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <chrono>
+#include <atomic>
+#if __has_include(<unistd.h>) && __has_include(<sys/mman.h>)
+#include <unistd.h>
+#define OHCLI_POSIX 1
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define OHCLI_AVX2 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define OHCLI_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define OHCLI_NEON 1
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define OHCLI_COROUTINES 1
+#endif
+// The non-template parts live in ohcli.cpp; with OHCLI_HEADER_ONLY it is included below.
+#ifdef OHCLI_HEADER_ONLY
+#define OHCLI_INLINE inline
+#else
+#define OHCLI_INLINE
+#endif
+// The value types whose conversions and add_value() paths ohcli.cpp instantiates.
+#define OHCLI_EXPLICIT_TYPES(X) \
+  X(bool) X(int) X(unsigned) X(long) X(unsigned long) X(long long) X(unsigned long long) \
+  X(float) X(double) X(std::string)
 
 namespace ohcli
 {
   using CmdArg = std::vector<std::string>;
   using Cmd = std::function<void(CmdArg &)>;
+  
+  class ArgSpan
+  {
+  private:
+    const std::string_view *first;
+    std::size_t count;
+  public:
+    ArgSpan() : first(nullptr), count(0) {}
+    
+    ArgSpan(const std::string_view *first_, std::size_t count_)
+        : first(first_), count(count_) {}
+    
+    const std::string_view *begin() const { return first; }
+    
+    const std::string_view *end() const { return first + count; }
+    
+    std::size_t size() const { return count; }
+    
+    bool empty() const { return count == 0; }
+    
+    const std::string_view &operator[](std::size_t i) const { return first[i]; }
+    
+    CmdArg to_cmdarg() const { return {begin(), end()}; }
+  };
+  
+  using SpanCmd = std::function<void(ArgSpan)>;
+  // Receives the arguments of a command in chunks while a stream is parsed; 'last' is set on the final call.
+  using StreamCmd = std::function<void(ArgSpan chunk, bool last)>;
   template<typename T>
   using Restrictor = std::function<bool(T &)>;
   
-  template<typename T>
-  Restrictor<T> range(T a, T b)
+  // Finds a registered name close to an unrecognized one, for Diagnostic::message().
+  class Suggester
   {
-    return [a, b](T &v) -> bool { return v >= a && v < b; };
-  }
+  public:
+    virtual ~Suggester() = default;
+    
+    // An empty string if nothing is close enough.
+    virtual std::string suggest(std::string_view name) const = 0;
+  };
   
-  template<typename T>
-  Restrictor<typename T::value_type> oneof(const T &s)
+  class Diagnostic
   {
-    return [s](typename T::value_type &v) -> bool
+  public:
+    enum class Code : std::uint8_t
     {
-      return std::find(std::cbegin(s), std::cend(s), v) != std::cend(s);
+      unrecognized_option, discarded_argument, too_few_arguments, too_many_arguments, recursive_response_file,
+      // An eager handler rejected its arguments during try_parse(); 'subject' is the first one.
+      invalid_value
     };
-  }
+    
+    // The 'word' of options taken from the environment or a config file, which are not in argv.
+    static constexpr std::uint32_t fallback = 0xffffffff;
+    
+    Code code;
+    // Index of the offending word in argv; words from a response file report its '@file' word,
+    // and the environment and config file report 'fallback'.
+    std::uint32_t word;
+    // The command, option or argument it is about; a view that lives as long as argv or the CLI.
+    std::string_view subject;
+    std::uint32_t given;
+    std::int32_t expected;
+    // Only asked when the message is formatted, so it must still be alive by then.
+    const Suggester *suggester;
+  public:
+    Diagnostic(Code code_, std::uint32_t word_, std::string_view subject_, std::uint32_t given_ = 0,
+               std::int32_t expected_ = 0)
+        : code(code_), word(word_), subject(subject_), given(given_), expected(expected_), suggester(nullptr) {}
+    
+    static Diagnostic unrecognized(std::uint32_t word, std::string_view subject, const Suggester *suggester)
+    {
+      Diagnostic d(Code::unrecognized_option, word, subject);
+      d.suggester = suggester;
+      return d;
+    }
+    
+    static std::optional<Diagnostic> arity(std::string_view name, std::uint32_t word, std::size_t given, int expected)
+    {
+      if (expected == -1 || given == static_cast<std::size_t>(expected))
+        return std::nullopt;
+      return Diagnostic(given < static_cast<std::size_t>(expected) ? Code::too_few_arguments : Code::too_many_arguments,
+                        word, name, static_cast<std::uint32_t>(given), expected);
+    }
+    
+    bool is_error() const
+    {
+      return code == Code::too_few_arguments || code == Code::recursive_response_file || code == Code::invalid_value;
+    }
+    
+    std::string message() const
+    {
+      if (word == fallback)
+        return "From the environment or the config file: " + describe();
+      return describe();
+    }
   
-  template<typename T>
-  Restrictor<T> oneof(const std::initializer_list<T> &s)
-  {
-    return [s](T &v) -> bool { return std::find(std::cbegin(s), std::cend(s), v) != std::cend(s); };
-  }
+  private:
+    std::string describe() const
+    {
+      switch (code)
+      {
+        case Code::unrecognized_option:
+        {
+          auto ret = "Unrecognized option '" + std::string(subject) + "'.";
+          auto hint = suggester == nullptr ? std::string() : suggester->suggest(subject);
+          if (!hint.empty())
+            ret += " Did you mean '" + hint + "'?";
+          return ret;
+        }
+        case Code::discarded_argument:
+          return "Discarded arguments '" + std::string(subject) + "'";
+        case Code::too_few_arguments:
+          return std::string(subject) + ": " + "Too few arguments (" + std::to_string(given) + "), expects "
+                 + std::to_string(expected);
+        case Code::too_many_arguments:
+          return std::string(subject) + ": " + "Expected " + std::to_string(expected) + " arguments, but "
+                 + std::to_string(given) + " was given.";
+        case Code::recursive_response_file:
+          return "Response file '" + std::string(subject) + "' includes itself.";
+        case Code::invalid_value:
+          return "Invalid value '" + std::string(subject) + "'.";
+      }
+      return {};
+    }
+  };
   
-  template<typename T>
-  Restrictor<T> default_restrictor()
+  // Collects diagnostics into storage reserved up front. Entries past the
+  // capacity are counted but dropped, so recording never allocates.
+  class Diagnostics
   {
-    return [](T &) -> bool { return true; };
-  }
+  private:
+    std::vector<Diagnostic> entries;
+    std::size_t capacity;
+    std::size_t dropped;
+    std::size_t errors;
+  public:
+    explicit Diagnostics(std::size_t capacity_ = 32)
+        : capacity(capacity_), dropped(0), errors(0) { entries.reserve(capacity); }
+    
+    void add(const Diagnostic &d)
+    {
+      if (d.is_error())
+        ++errors;
+      if (entries.size() < capacity)
+        entries.emplace_back(d);
+      else
+        ++dropped;
+    }
+    
+    void clear()
+    {
+      entries.clear();
+      dropped = 0;
+      errors = 0;
+    }
+    
+    bool has_errors() const { return errors != 0; }
+    
+    bool empty() const { return entries.empty() && dropped == 0; }
+    
+    std::size_t size() const { return entries.size(); }
+    
+    std::size_t overflow() const { return dropped; }
+    
+    auto begin() const { return entries.cbegin(); }
+    
+    auto end() const { return entries.cend(); }
+    
+    std::string format() const
+    {
+      std::string ret;
+      for (auto &r: entries)
+        ret += (r.is_error() ? "error: " : "warning: ") + r.message() + "\n";
+      if (dropped != 0)
+        ret += std::to_string(dropped) + " more diagnostics omitted.\n";
+      return ret;
+    }
+  };
   
-  Restrictor<std::string> regex(const std::string &pattern)
+  // Receives timings of a CLI's parse and run phases, see CLI::set_observer(). Until one is
+  // set the probes cost a null check. Callbacks of tasks run by run_parallel() may come from
+  // several threads.
+  class Observer
   {
-    return [pattern](std::string &v) -> bool
+  public:
+    enum class Phase : std::uint8_t
     {
-      return std::regex_match(v, std::regex{pattern});
+      // 'count' is the number of words, tokens after expansion, packed tasks and scheduled tasks.
+      tokenize, expand, pack, schedule
     };
-  }
-  
-  Restrictor<std::string> email()
-  {
-    return regex("^\\w+([-+.]\\w+)*@\\w+([-.]\\w+)*\\.\\w+([-.]\\w+)*$");
-  }
+    
+    virtual ~Observer() = default;
+    
+    virtual void on_phase(Phase, std::chrono::nanoseconds, std::size_t) {}
+    
+    // Registry lookups of one parse, bundled short flags included.
+    virtual void on_lookups(std::size_t) {}
+    
+    virtual void on_task(std::string_view, std::chrono::nanoseconds) {}
+    
+    virtual void on_regex_compile(std::string_view, std::chrono::nanoseconds, bool) {}
+    
+    virtual void on_regex_match(std::chrono::nanoseconds, bool) {}
+  };
   
   namespace utils
   {
+    // Regex restrictors don't belong to a CLI, so they report here; see ohcli::observe_regex().
+    inline std::atomic<Observer *> regex_observer{nullptr};
+    
+    // Times consecutive phases for an observer; with a null observer it does nothing.
+    class Probe
+    {
+    private:
+      using Clock = std::chrono::steady_clock;
+      Observer *observer;
+      Clock::time_point start;
+    public:
+      explicit Probe(Observer *observer_) : observer(observer_), start(observer ? Clock::now() : Clock::time_point()) {}
+      
+      template<typename Report>
+      void lap(Report &&report)
+      {
+        if (observer == nullptr)
+          return;
+        auto now = Clock::now();
+        report(*observer, std::chrono::duration_cast<std::chrono::nanoseconds>(now - start));
+        start = now;
+      }
+      
+      void phase(Observer::Phase phase, std::size_t count)
+      {
+        lap([&](Observer &o, std::chrono::nanoseconds t) { o.on_phase(phase, t, count); });
+      }
+    };
+    
     class Error : public std::runtime_error
     {
     public:
@@ -79,373 +317,3711 @@ namespace ohcli
           : runtime_error(details) {}
     };
     
-    void fatal(const std::string &str)
+    OHCLI_INLINE void fatal(const std::string &str);
+    
+    OHCLI_INLINE void error(const std::string &str);
+    
+    OHCLI_INLINE void warn(const std::string &str);
+    
+    template<typename T>
+    inline constexpr std::string_view type_name = "value";
+    template<>
+    inline constexpr std::string_view type_name<std::string> = "string";
+    template<>
+    inline constexpr std::string_view type_name<bool> = "boolean";
+    template<>
+    inline constexpr std::string_view type_name<char> = "char";
+    template<>
+    inline constexpr std::string_view type_name<signed char> = "signed char";
+    template<>
+    inline constexpr std::string_view type_name<unsigned char> = "unsigned char";
+    template<>
+    inline constexpr std::string_view type_name<short> = "short";
+    template<>
+    inline constexpr std::string_view type_name<unsigned short> = "unsigned short";
+    template<>
+    inline constexpr std::string_view type_name<int> = "int";
+    template<>
+    inline constexpr std::string_view type_name<unsigned> = "unsigned int";
+    template<>
+    inline constexpr std::string_view type_name<long> = "long";
+    template<>
+    inline constexpr std::string_view type_name<unsigned long> = "unsigned long";
+    template<>
+    inline constexpr std::string_view type_name<long long> = "long long";
+    template<>
+    inline constexpr std::string_view type_name<unsigned long long> = "unsigned long long";
+    template<>
+    inline constexpr std::string_view type_name<float> = "float";
+    template<>
+    inline constexpr std::string_view type_name<double> = "double";
+    template<>
+    inline constexpr std::string_view type_name<long double> = "long double";
+    
+    template<typename T>
+    inline constexpr bool has_from_str = std::is_arithmetic_v<T> || std::is_same_v<T, std::string>;
+    
+    // Locale-independent and non-throwing. Integers take an optional sign and a
+    // 0x/0o/0b prefix, floats take 0x for hexadecimal. The whole string must be consumed.
+    template<typename T>
+    std::errc from_str(std::string_view s, T &value)
+    {
+      static_assert(has_from_str<T>, "from_str() supports arithmetic types and std::string.");
+      const char *first = s.data();
+      const char *last = s.data() + s.size();
+      if constexpr (std::is_same_v<T, std::string>)
+      {
+        value.assign(first, last);
+        return {};
+      }
+      else if constexpr (std::is_same_v<T, bool>)
+      {
+        if (s == "true" || s == "True" || s == "TRUE")
+          value = true;
+        else if (s == "false" || s == "False" || s == "FALSE")
+          value = false;
+        else
+          return std::errc::invalid_argument;
+        return {};
+      }
+      else
+      {
+        bool negative = false;
+        if (first != last && (*first == '+' || *first == '-'))
+          negative = *first++ == '-';
+        int base = 10;
+        if (last - first > 2 && first[0] == '0')
+        {
+          switch (first[1])
+          {
+            case 'x':
+            case 'X':
+              base = 16;
+              break;
+            case 'o':
+            case 'O':
+              base = 8;
+              break;
+            case 'b':
+            case 'B':
+              base = 2;
+              break;
+          }
+          if (base != 10)
+            first += 2;
+        }
+        if (first == last || *first == '+' || *first == '-')
+          return std::errc::invalid_argument;
+        std::from_chars_result res{};
+        if constexpr (std::is_floating_point_v<T>)
+        {
+          if (base == 8 || base == 2)
+            return std::errc::invalid_argument;
+          T magnitude{};
+          res = std::from_chars(first, last, magnitude,
+                                base == 16 ? std::chars_format::hex : std::chars_format::general);
+          if (res.ec == std::errc{} && res.ptr == last)
+            value = negative ? -magnitude : magnitude;
+        }
+        else
+        {
+          using U = std::make_unsigned_t<T>;
+          U magnitude{};
+          res = std::from_chars(first, last, magnitude, base);
+          if (res.ec == std::errc{} && res.ptr == last)
+          {
+            U limit = std::numeric_limits<T>::max();
+            if (negative)
+              limit = std::is_signed_v<T> ? static_cast<U>(limit + 1) : 0;
+            if (magnitude > limit)
+              return std::errc::result_out_of_range;
+            value = negative ? static_cast<T>(U(0) - magnitude) : static_cast<T>(magnitude);
+          }
+        }
+        if (res.ec != std::errc{})
+          return res.ec;
+        if (res.ptr != last)
+          return std::errc::invalid_argument;
+        return {};
+      }
+    }
+    
+    // First 'c' in [first, last), or 'last'; scans 16 or 32 bytes per step where SIMD is available.
+    inline const char *find_char(const char *first, const char *last, char c)
+    {
+#if defined(OHCLI_AVX2)
+      const __m256i needle = _mm256_set1_epi8(c);
+      for (; last - first >= 32; first += 32)
+      {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        auto mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask != 0)
+          return first + __builtin_ctz(mask);
+      }
+#elif defined(OHCLI_SSE2)
+      const __m128i needle = _mm_set1_epi8(c);
+      for (; last - first >= 16; first += 16)
+      {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+        if (mask != 0)
+          return first + __builtin_ctz(mask);
+      }
+#elif defined(OHCLI_NEON)
+      const uint8x16_t needle = vdupq_n_u8(static_cast<std::uint8_t>(c));
+      for (; last - first >= 16; first += 16)
+      {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const std::uint8_t *>(first)), needle);
+        // Narrowing leaves 4 bits per byte, so the mask fits in 64 bits.
+        std::uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        if (mask != 0)
+          return first + (__builtin_ctzll(mask) >> 2);
+      }
+#endif
+      for (; first != last; ++first)
+        if (*first == c)
+          return first;
+      return last;
+    }
+    
+    inline std::size_t count_char(const char *first, const char *last, char c)
+    {
+      std::size_t count = 0;
+#if defined(OHCLI_AVX2)
+      const __m256i needle = _mm256_set1_epi8(c);
+      for (; last - first >= 32; first += 32)
+      {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(first));
+        count += static_cast<std::size_t>(
+            __builtin_popcount(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)))));
+      }
+#elif defined(OHCLI_SSE2)
+      const __m128i needle = _mm_set1_epi8(c);
+      for (; last - first >= 16; first += 16)
+      {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(first));
+        count += static_cast<std::size_t>(
+            __builtin_popcount(static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)))));
+      }
+#elif defined(OHCLI_NEON)
+      const uint8x16_t needle = vdupq_n_u8(static_cast<std::uint8_t>(c));
+      const uint8x16_t one = vdupq_n_u8(1);
+      for (; last - first >= 16; first += 16)
+      {
+        uint8x16_t eq = vceqq_u8(vld1q_u8(reinterpret_cast<const std::uint8_t *>(first)), needle);
+        count += vaddvq_u8(vandq_u8(eq, one));
+      }
+#endif
+      for (; first != last; ++first)
+        count += *first == c;
+      return count;
+    }
+    
+    template<typename T>
+    class Result
+    {
+    private:
+      T val;
+      std::errc ec;
+    public:
+      Result(T val_, std::errc ec_) : val(std::move(val_)), ec(ec_) {}
+      
+      bool has_value() const { return ec == std::errc{}; }
+      
+      explicit operator bool() const { return has_value(); }
+      
+      const T &value() const { return val; }
+      
+      T value_or(T v) const { return has_value() ? val : std::move(v); }
+      
+      std::errc error() const { return ec; }
+    };
+    
+    template<typename T>
+    Result<T> try_str_to(std::string_view s)
+    {
+      T value{};
+      std::errc ec = from_str(s, value);
+      return {std::move(value), ec};
+    }
+    
+    // Specialize this for types that from_str() doesn't support.
+    template<typename T>
+    T str_to(const std::string &s)
+    {
+      T value{};
+      if (from_str(s, value) != std::errc{})
+        error("Unexpected conversion of '" + s + "' to " + std::string(type_name<T>) + ".");
+      return value;
+    }
+    
+    template<typename T>
+    T convert(std::string_view s)
+    {
+      if constexpr (has_from_str<T>)
+      {
+        T value{};
+        if (from_str(s, value) != std::errc{})
+          error("Unexpected conversion of '" + std::string(s) + "' to " + std::string(type_name<T>) + ".");
+        return value;
+      }
+      else
+        return str_to<T>(std::string(s));
+    }
+#ifndef OHCLI_HEADER_ONLY
+    
+    // The common conversions are instantiated once, in ohcli.cpp.
+#define OHCLI_EXTERN_CONVERSION(T) \
+    extern template std::errc from_str<T>(std::string_view, T &); \
+    extern template T convert<T>(std::string_view);
+    OHCLI_EXPLICIT_TYPES(OHCLI_EXTERN_CONVERSION)
+#undef OHCLI_EXTERN_CONVERSION
+#endif
+    
+    // Calls item(value, text) for each 'delimiter' separated item of 'list'. Plain decimal
+    // numbers are read by one from_chars() that stops at the delimiter; anything else
+    // (prefixes, '+', errors) goes through from_str() on the item found by find_char().
+    template<typename T, typename Item>
+    void for_each_item(std::string_view list, char delimiter, Item &&item)
+    {
+      const char *first = list.data();
+      const char *last = first + list.size();
+      for (;;)
+      {
+        if constexpr (std::is_arithmetic_v<T> && !std::is_same_v<T, bool>)
+        {
+          T value{};
+          auto res = std::from_chars(first, last, value);
+          if (res.ec == std::errc{} && (res.ptr == last || *res.ptr == delimiter))
+          {
+            item(std::move(value), std::string_view(first, static_cast<std::size_t>(res.ptr - first)));
+            if (res.ptr == last)
+              return;
+            first = res.ptr + 1;
+            continue;
+          }
+        }
+        const char *end = find_char(first, last, delimiter);
+        std::string_view text(first, static_cast<std::size_t>(end - first));
+        item(convert<T>(text), text);
+        if (end == last)
+          return;
+        first = end + 1;
+      }
+    }
+    
+    inline void report(const Diagnostic &d)
+    {
+      if (d.is_error())
+        error(d.message());
+      else
+        warn(d.message());
+    }
+    
+    inline void check_arity(std::string_view name, std::size_t given, int expected)
+    {
+      if (auto d = Diagnostic::arity(name, 0, given, expected))
+        report(*d);
+    }
+    
+    // A move-only std::function replacement that keeps callables of up to 'Size' bytes
+    // inline, so binding a handler doesn't allocate and calling it is one indirect call.
+    template<typename Signature, std::size_t Size = 48>
+    class SmallFunction;
+    
+    template<typename R, typename... Args, std::size_t Size>
+    class SmallFunction<R(Args...), Size>
+    {
+    private:
+      struct VTable
+      {
+        R (*invoke)(void *, Args...);
+        void (*move)(void *, void *) noexcept;
+        void (*destroy)(void *) noexcept;
+      };
+      
+      template<typename F>
+      static constexpr bool is_inline = sizeof(F) <= Size && alignof(F) <= alignof(std::max_align_t)
+                                        && std::is_nothrow_move_constructible_v<F>;
+      
+      alignas(std::max_align_t) mutable unsigned char storage[Size];
+      const VTable *vtable;
+      
+      template<typename F>
+      static const VTable *vtable_for()
+      {
+        if constexpr (is_inline<F>)
+        {
+          static constexpr VTable vt{
+              [](void *p, Args... args) -> R { return (*static_cast<F *>(p))(std::forward<Args>(args)...); },
+              [](void *from, void *to) noexcept
+              {
+                new(to) F(std::move(*static_cast<F *>(from)));
+                static_cast<F *>(from)->~F();
+              },
+              [](void *p) noexcept { static_cast<F *>(p)->~F(); }};
+          return &vt;
+        }
+        else
+        {
+          static constexpr VTable vt{
+              [](void *p, Args... args) -> R { return (**static_cast<F **>(p))(std::forward<Args>(args)...); },
+              [](void *from, void *to) noexcept { *static_cast<F **>(to) = *static_cast<F **>(from); },
+              [](void *p) noexcept { delete *static_cast<F **>(p); }};
+          return &vt;
+        }
+      }
+    
+    public:
+      SmallFunction() : vtable(nullptr) {}
+      
+      template<typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, SmallFunction>>>
+      SmallFunction(F &&f)
+          : vtable(vtable_for<std::decay_t<F>>())
+      {
+        using D = std::decay_t<F>;
+        if constexpr (is_inline<D>)
+          new(storage) D(std::forward<F>(f));
+        else
+          *reinterpret_cast<D **>(storage) = new D(std::forward<F>(f));
+      }
+      
+      SmallFunction(SmallFunction &&other) noexcept
+          : vtable(other.vtable)
+      {
+        if (vtable != nullptr)
+          vtable->move(other.storage, storage);
+        other.vtable = nullptr;
+      }
+      
+      SmallFunction &operator=(SmallFunction &&other) noexcept
+      {
+        if (this != &other)
+        {
+          this->~SmallFunction();
+          new(this) SmallFunction(std::move(other));
+        }
+        return *this;
+      }
+      
+      SmallFunction(const SmallFunction &) = delete;
+      
+      SmallFunction &operator=(const SmallFunction &) = delete;
+      
+      ~SmallFunction()
+      {
+        if (vtable != nullptr)
+          vtable->destroy(storage);
+      }
+      
+      explicit operator bool() const { return vtable != nullptr; }
+      
+      R operator()(Args... args) const
+      {
+        return vtable->invoke(storage, std::forward<Args>(args)...);
+      }
+    };
+    
+    // '-x' and '--x' name an option, a lone '-' is an argument.
+    constexpr bool is_option(std::string_view word)
+    {
+      return word.size() > 1 && word[0] == '-';
+    }
+    
+    constexpr std::string_view strip(std::string_view word)
+    {
+      return (word[1] == '-' && word.size() != 2) ? word.substr(2) : word.substr(1);
+    }
+    
+    // Position of the '=' in '--name=value', or npos.
+    constexpr std::size_t assignment(std::string_view word)
+    {
+      if (word.size() < 4 || word[0] != '-' || word[1] != '-')
+        return std::string_view::npos;
+      return word.find('=', 3);
+    }
+    
+    constexpr bool is_space(char c)
+    {
+      return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+    
+    // Splits response-file style text into words, carrying its state across chunks:
+    // whitespace separates words, '...' quotes literally, "..." quotes with backslash
+    // escapes, and outside quotes a backslash escapes the next character.
+    class WordSplitter
+    {
+    private:
+      enum class State
+      {
+        space, word, single, dbl, escape, dbl_escape
+      };
+      State state;
+      bool has_word;
+      std::string word;
+    public:
+      WordSplitter() : state(State::space), has_word(false) {}
+      
+      template<typename Emit>
+      void feed(const char *first, const char *last, Emit &&emit)
+      {
+        for (; first != last; ++first)
+        {
+          char c = *first;
+          switch (state)
+          {
+            case State::space:
+            case State::word:
+              if (is_space(c))
+              {
+                flush(emit);
+                state = State::space;
+                continue;
+              }
+              has_word = true;
+              state = State::word;
+              if (c == '\'')
+                state = State::single;
+              else if (c == '"')
+                state = State::dbl;
+              else if (c == '\\')
+                state = State::escape;
+              else
+                word += c;
+              break;
+            case State::single:
+              if (c == '\'')
+                state = State::word;
+              else
+                word += c;
+              break;
+            case State::dbl:
+              if (c == '"')
+                state = State::word;
+              else if (c == '\\')
+                state = State::dbl_escape;
+              else
+                word += c;
+              break;
+            case State::escape:
+              word += c;
+              state = State::word;
+              break;
+            case State::dbl_escape:
+              if (c != '"' && c != '\\')
+                word += '\\';
+              word += c;
+              state = State::dbl;
+              break;
+          }
+        }
+      }
+      
+      template<typename Emit>
+      void finish(Emit &&emit)
+      {
+        flush(emit);
+        state = State::space;
+      }
+    
+    private:
+      template<typename Emit>
+      void flush(Emit &emit)
+      {
+        if (!has_word)
+          return;
+        emit(std::string_view(word));
+        word.clear();
+        has_word = false;
+      }
+    };
+    
+    // Same rules as WordSplitter, but unescapes in place, so the emitted words are views into 'first..last'.
+    template<typename Emit>
+    void split_words(char *first, char *last, Emit &&emit)
+    {
+      while (first != last)
+      {
+        if (is_space(*first))
+        {
+          ++first;
+          continue;
+        }
+        char *begin = first, *out = first;
+        char quote = 0;
+        // Until a quote or an escape is dropped, 'out' is 'first' and the byte is already
+        // in place; not writing it keeps a copy-on-write mapping's pages clean.
+        auto put = [&out, &first](char ch)
+        {
+          if (out != first)
+            *out = ch;
+          ++out;
+        };
+        for (; first != last; ++first)
+        {
+          char c = *first;
+          if (quote == '\'')
+          {
+            if (c == '\'')
+              quote = 0;
+            else
+              put(c);
+          }
+          else if (quote == '"')
+          {
+            if (c == '"')
+              quote = 0;
+            else if (c != '\\')
+              put(c);
+            else if (first + 1 != last)
+            {
+              ++first;
+              if (*first != '"' && *first != '\\')
+                put('\\');
+              put(*first);
+            }
+          }
+          else if (is_space(c))
+            break;
+          else if (c == '\'' || c == '"')
+            quote = c;
+          else if (c != '\\')
+            put(c);
+          else if (first + 1 != last)
+          {
+            ++first;
+            put(*first);
+          }
+        }
+        emit(std::string_view(begin, static_cast<std::size_t>(out - begin)));
+      }
+    }
+    
+    struct FileId
+    {
+      std::uint64_t dev;
+      std::uint64_t ino;
+      
+      bool operator==(const FileId &rhs) const { return dev == rhs.dev && ino == rhs.ino; }
+    };
+    
+    // The contents of a file, mapped copy-on-write when possible so they can be edited in
+    // place without touching the file; otherwise read into a buffer.
+    class MappedFile
+    {
+    private:
+      char *ptr;
+      std::size_t len;
+      bool mapped;
+      FileId file_id;
+      std::vector<char> buffer;
+    public:
+      MappedFile() : ptr(nullptr), len(0), mapped(false), file_id{0, 0} {}
+      
+      MappedFile(MappedFile &&rhs) noexcept
+          : ptr(rhs.ptr), len(rhs.len), mapped(rhs.mapped), file_id(rhs.file_id), buffer(std::move(rhs.buffer))
+      {
+        rhs.ptr = nullptr;
+        rhs.len = 0;
+        rhs.mapped = false;
+      }
+      
+      MappedFile &operator=(MappedFile &&rhs) noexcept
+      {
+        std::swap(ptr, rhs.ptr);
+        std::swap(len, rhs.len);
+        std::swap(mapped, rhs.mapped);
+        std::swap(file_id, rhs.file_id);
+        buffer.swap(rhs.buffer);
+        return *this;
+      }
+      
+      ~MappedFile() { close(); }
+      
+      char *data() const { return ptr; }
+      
+      std::size_t size() const { return len; }
+      
+      FileId id() const { return file_id; }
+      
+      // Returns false if 'path' can't be read.
+      OHCLI_INLINE bool open(const std::string &path);
+#ifdef OHCLI_POSIX
+      
+      // Maps the whole of 'fd', which stays open and owned by the caller.
+      OHCLI_INLINE bool open(int fd);
+#endif
+      
+      OHCLI_INLINE void close();
+    
+    private:
+      template<typename Read>
+      bool read_all(Read &&read);
+    };
+    
+    // Levenshtein distance of 'pattern' (up to 64 chars, 'peq' holding the positions of
+    // each byte in it) and 'text', with Myers' bit-parallel algorithm: one column of the DP
+    // matrix per word operation. Returns 'limit' + 1 as soon as the distance must exceed it.
+    OHCLI_INLINE std::size_t edit_distance(const std::array<std::uint64_t, 256> &peq, std::size_t m,
+                                           std::string_view text, std::size_t limit);
+    
+    // The entries of an INI-style file as views into a mapping of the file, or of a binary
+    // cache of it. Each 'name = words' line is one entry; the words are split like a
+    // response file, '#' and ';' start comment lines, and '[section]' prefixes the names
+    // that follow with 'section.'.
+    class ConfigFile
+    {
+    public:
+      struct Entry
+      {
+        std::string_view key;
+        std::uint32_t first;
+        std::uint32_t count;
+      };
+    private:
+      static constexpr std::uint32_t magic = 0x4643484f;// "OHCF"
+      static constexpr std::uint32_t version = 1;
+      
+      struct Header
+      {
+        std::uint32_t magic;
+        std::uint32_t version;
+        std::uint64_t size;
+        std::int64_t mtime;
+        std::uint32_t path;
+        std::uint32_t entries;
+        std::uint32_t words;
+        std::uint32_t blob;
+      };
+      
+      struct Span
+      {
+        std::uint32_t offset;
+        std::uint32_t size;
+      };
+      
+      MappedFile file;
+      std::deque<std::string> names;
+      std::vector<Entry> entries;
+      std::vector<std::string_view> words;
+    public:
+      // Returns false if 'path' can't be read. A valid 'cache' is used instead of the text,
+      // and an outdated or missing one is rewritten; failing to write it is not an error.
+      OHCLI_INLINE bool open(const std::string &path, const std::string &cache = "");
+      
+      const std::vector<Entry> &get_entries() const { return entries; }
+      
+      std::string_view word(std::size_t i) const { return words[i]; }
+    
+    private:
+      static std::string_view trim(std::string_view s)
+      {
+        while (!s.empty() && is_space(s.front()))
+          s.remove_prefix(1);
+        while (!s.empty() && is_space(s.back()))
+          s.remove_suffix(1);
+        return s;
+      }
+      
+      void clear()
+      {
+        file.close();
+        names.clear();
+        entries.clear();
+        words.clear();
+      }
+      
+      OHCLI_INLINE bool parse(const std::string &path);
+      
+      OHCLI_INLINE bool load(const std::string &cache, const std::string &path, std::uint64_t size, std::int64_t mtime);
+      
+      OHCLI_INLINE void store(const std::string &cache, const std::string &path, std::uint64_t size,
+                              std::int64_t mtime) const;
+    };
+    
+    struct Unrestricted
+    {
+      template<typename T>
+      bool operator()(const T &) const { return true; }
+    };
+    
+    // Mirrors std::regex_constants::syntax_option_type, so <regex> stays out of the header.
+    enum class RegexFlags : unsigned
+    {
+      ECMAScript = 0,
+      icase = 1 << 0,
+      nosubs = 1 << 1,
+      optimize = 1 << 2,
+      collate = 1 << 3,
+      basic = 1 << 4,
+      extended = 1 << 5,
+      awk = 1 << 6,
+      grep = 1 << 7,
+      egrep = 1 << 8
+    };
+    
+    constexpr RegexFlags operator|(RegexFlags a, RegexFlags b)
+    {
+      return static_cast<RegexFlags>(static_cast<unsigned>(a) | static_cast<unsigned>(b));
+    }
+    
+    constexpr bool operator&(RegexFlags a, RegexFlags b)
+    {
+      return (static_cast<unsigned>(a) & static_cast<unsigned>(b)) != 0;
+    }
+    
+    struct CompiledRegex;
+    
+    OHCLI_INLINE std::shared_ptr<const CompiledRegex> compile_regex(const std::string &pattern, RegexFlags flags);
+  }
+  
+  // Restrictors are plain function objects, so add_value() can store them by value;
+  // they still convert to Restrictor<T>.
+  template<typename T>
+  auto range(T a, T b)
+  {
+    return [a, b](const T &v) -> bool { return v >= a && v < b; };
+  }
+  
+  // The allowed values are copied into a sorted flat array, so a check is a binary
+  // search (a short scan for small sets). Types without operator< are scanned as given.
+  template<typename T>
+  class OneOf
+  {
+  private:
+    static constexpr bool sortable = std::is_invocable_r_v<bool, std::less<>, const T &, const T &>;
+    std::vector<T> values;
+  public:
+    template<typename It>
+    OneOf(It first, It last) : values(first, last)
+    {
+      if constexpr (sortable)
+      {
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+      }
+      values.shrink_to_fit();
+    }
+    
+    bool operator()(const T &v) const
+    {
+      if constexpr (sortable)
+      {
+        if (values.size() > 16)
+          return std::binary_search(values.cbegin(), values.cend(), v);
+      }
+      return std::find(values.cbegin(), values.cend(), v) != values.cend();
+    }
+  };
+  
+  template<typename T>
+  OneOf<typename T::value_type> oneof(const T &s)
+  {
+    return OneOf<typename T::value_type>(std::cbegin(s), std::cend(s));
+  }
+  
+  template<typename T>
+  OneOf<T> oneof(std::initializer_list<T> s)
+  {
+    return OneOf<T>(s.begin(), s.end());
+  }
+  
+  // Maps names to values, e.g. of an enum, for CLI::add_choice(). Looking up a name is a
+  // binary search over views of the argument, so the value is found without a conversion.
+  template<typename E>
+  class Choices
+  {
+  private:
+    std::vector<std::pair<std::string, E>> entries;
+  public:
+    Choices(std::initializer_list<std::pair<std::string_view, E>> list)
+    {
+      entries.reserve(list.size());
+      for (auto &r: list)
+        entries.emplace_back(std::string(r.first), r.second);
+      std::sort(entries.begin(), entries.end(), [](auto &a, auto &b) { return a.first < b.first; });
+      auto dup = std::adjacent_find(entries.cbegin(), entries.cend(),
+                                    [](auto &a, auto &b) { return a.first == b.first; });
+      if (dup != entries.cend())
+        utils::fatal("Choice '" + dup->first + "' added twice.");
+    }
+    
+    const E *find(std::string_view name) const
+    {
+      auto it = std::lower_bound(entries.cbegin(), entries.cend(), name,
+                                 [](auto &a, std::string_view b) { return std::string_view(a.first) < b; });
+      if (it == entries.cend() || it->first != name)
+        return nullptr;
+      return &it->second;
+    }
+  };
+  
+  template<typename T>
+  Restrictor<T> default_restrictor()
+  {
+    return [](T &) -> bool { return true; };
+  }
+  
+  // CLI declares its asynchronous members with Task in every translation unit, so the class
+  // is the same with and without coroutines; they are defined, after CLI, only with them.
+  class Task;
+#ifdef OHCLI_COROUTINES
+  
+  // A lazily started coroutine, returned by asynchronous commands and by run_async().
+  // co_await it from another coroutine, or start() it and let the event loop that the
+  // commands' own awaitables resume on drive it until done().
+  class Task
+  {
+  public:
+    struct promise_type
+    {
+      std::coroutine_handle<> continuation;
+      std::exception_ptr error;
+      
+      Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+      
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      
+      auto final_suspend() noexcept
+      {
+        struct Awaiter
+        {
+          bool await_ready() noexcept { return false; }
+          
+          std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+          {
+            auto next = h.promise().continuation;
+            return next ? next : std::noop_coroutine();
+          }
+          
+          void await_resume() noexcept {}
+        };
+        return Awaiter{};
+      }
+      
+      void return_void() {}
+      
+      void unhandled_exception() { error = std::current_exception(); }
+    };
+  
+  private:
+    std::coroutine_handle<promise_type> handle;
+  public:
+    explicit Task(std::coroutine_handle<promise_type> handle_) : handle(handle_) {}
+    
+    Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    
+    Task &operator=(Task &&other) noexcept
+    {
+      if (this != &other)
+      {
+        if (handle)
+          handle.destroy();
+        handle = std::exchange(other.handle, nullptr);
+      }
+      return *this;
+    }
+    
+    ~Task()
+    {
+      if (handle)
+        handle.destroy();
+    }
+    
+    void start() { handle.resume(); }
+    
+    bool done() const { return !handle || handle.done(); }
+    
+    // Rethrows what the coroutine threw, once it is done.
+    void get() const
+    {
+      if (handle && handle.promise().error)
+        std::rethrow_exception(handle.promise().error);
+    }
+    
+    bool await_ready() const noexcept { return done(); }
+    
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept
+    {
+      handle.promise().continuation = h;
+      return handle;
+    }
+    
+    void await_resume() const { get(); }
+  };
+  
+  using AsyncCmd = std::function<Task(ArgSpan)>;
+#endif
+  
+  class Regex
+  {
+  private:
+    std::shared_ptr<const utils::CompiledRegex> compiled;
+  public:
+    explicit Regex(std::shared_ptr<const utils::CompiledRegex> compiled_)
+        : compiled(std::move(compiled_)) {}
+    
+    OHCLI_INLINE bool operator()(const std::string &v) const;
+  };
+  
+  // Reports compilations and matches of every regex restrictor in the process; nullptr stops it.
+  inline void observe_regex(Observer *observer)
+  {
+    utils::regex_observer.store(observer, std::memory_order_release);
+  }
+  
+  // The pattern is compiled once here, and restrictors sharing a pattern share one automaton.
+  OHCLI_INLINE Regex regex(const std::string &pattern, utils::RegexFlags flags = utils::RegexFlags::ECMAScript);
+  
+  OHCLI_INLINE Regex email();
+  
+  // Keeps the raw argument of a value and converts and restricts it on first access, so
+  // values that are never read, or are overwritten by a later occurrence, cost nothing.
+  // The raw argument is copied, so it doesn't depend on the parse; the next parse() or
+  // reset() of the CLI clears the value.
+  template<typename T>
+  class lazy
+  {
+    friend class CLI;
+  private:
+    std::string raw;
+    bool present;
+    mutable std::optional<T> converted;
+    Restrictor<T> restrictor;
+  public:
+    lazy() : present(false) {}
+    
+    bool has_value() const { return present; }
+    
+    std::string_view str() const { return raw; }
+    
+    const T &get() const
+    {
+      if (!present)
+        utils::error("Value has not been given.");
+      if (!converted)
+      {
+        T temp = utils::convert<T>(raw);
+        if (restrictor && !restrictor(temp))
+          utils::error("Invaild value '" + std::string(raw) + "'");
+        converted = std::move(temp);
+      }
+      return *converted;
+    }
+    
+    const T &operator*() const { return get(); }
+    
+    const T *operator->() const { return &get(); }
+    
+    T value_or(T fallback) const { return present ? get() : std::move(fallback); }
+  
+  private:
+    void set(std::string_view raw_)
+    {
+      raw.assign(raw_.data(), raw_.size());
+      present = true;
+      converted.reset();
+    }
+    
+    void clear()
+    {
+      raw.clear();
+      present = false;
+      converted.reset();
+    }
+  };
+  
+  // One option of a Batch: a bit per row telling whether it was given. A Column<T> also
+  // keeps the value of the last occurrence in each row.
+  class BatchColumn
+  {
+    friend class CLI;
+    friend class Batch;
+  private:
+    std::vector<std::uint64_t> present;
+  public:
+    virtual ~BatchColumn() = default;
+    
+    bool has(std::size_t row) const { return (present[row >> 6] >> (row & 63)) & 1; }
+    
+    // Row 'i' is bit i % 64 of word i / 64.
+    const std::vector<std::uint64_t> &bits() const { return present; }
+  
+  protected:
+    void mark(std::size_t row) { present[row >> 6] |= std::uint64_t(1) << (row & 63); }
+    
+    virtual void resize(std::size_t rows) { present.assign((rows + 63) / 64, 0); }
+    
+    // Returns false if the arguments don't convert or are rejected by the restrictor.
+    virtual bool set(std::size_t row, ArgSpan)
+    {
+      mark(row);
+      return true;
+    }
+  };
+  
+  template<typename T>
+  class Column : public BatchColumn
+  {
+  private:
+    std::unique_ptr<T[]> values;
+    Restrictor<T> restrictor;
+  public:
+    explicit Column(Restrictor<T> restrictor_) : restrictor(std::move(restrictor_)) {}
+    
+    // T() where the option wasn't given.
+    const T &operator[](std::size_t row) const { return values[row]; }
+    
+    const T *data() const { return values.get(); }
+  
+  private:
+    void resize(std::size_t rows) override
+    {
+      BatchColumn::resize(rows);
+      values.reset(new T[rows]());
+    }
+    
+    bool set(std::size_t row, ArgSpan args) override
+    {
+      if (args.size() == 0)
+        return false;
+      T temp{};
+      if constexpr (utils::has_from_str<T>)
+      {
+        if (utils::from_str(args[0], temp) != std::errc{})
+          return false;
+      }
+      else
+      {
+        try
+        {
+          temp = utils::convert<T>(args[0]);
+        }
+        catch (std::runtime_error &)
+        {
+          return false;
+        }
+      }
+      if (restrictor && !restrictor(temp))
+        return false;
+      values[row] = std::move(temp);
+      mark(row);
+      return true;
+    }
+  };
+  
+  // Columnar results of CLI::parse_batch(): one column per added option, indexed by row.
+  // A row is rejected if it has an unrecognized option, an option with the wrong number of
+  // arguments, or a value that doesn't convert; its columns keep whatever did.
+  class Batch
+  {
+    friend class CLI;
+  public:
+    // Concurrent parse_batch() calls must start at multiples of this, so that they never
+    // share a word of a bitmap.
+    static constexpr std::size_t alignment = 64;
+  private:
+    std::vector<std::pair<std::string, std::unique_ptr<BatchColumn>>> columns;
+    std::vector<std::uint64_t> rejected;
+    std::size_t rows;
+  public:
+    Batch() : rows(0) {}
+    
+    // 'name' is any name or alias of the option; T is converted like add_value() does.
+    template<typename T>
+    const Column<T> &add_column(const std::string &name, Restrictor<T> restrictor = nullptr)
+    {
+      auto column = std::make_unique<Column<T>>(std::move(restrictor));
+      auto &ret = *column;
+      add(name, std::move(column));
+      return ret;
+    }
+    
+    // Only records whether 'name' was given.
+    const BatchColumn &add_flag(const std::string &name)
+    {
+      auto column = std::make_unique<BatchColumn>();
+      auto &ret = *column;
+      add(name, std::move(column));
+      return ret;
+    }
+    
+    // Sizes every column for 'rows' rows and clears them.
+    Batch &resize(std::size_t rows_)
+    {
+      rows = rows_;
+      rejected.assign((rows + 63) / 64, 0);
+      for (auto &r: columns)
+        r.second->resize(rows);
+      return *this;
+    }
+    
+    std::size_t size() const { return rows; }
+    
+    bool is_rejected(std::size_t row) const { return (rejected[row >> 6] >> (row & 63)) & 1; }
+    
+    const std::vector<std::uint64_t> &rejected_bits() const { return rejected; }
+  
+  private:
+    void add(const std::string &name, std::unique_ptr<BatchColumn> column)
+    {
+      column->resize(rows);
+      columns.emplace_back(name, std::move(column));
+    }
+    
+    void reject(std::size_t row) { rejected[row >> 6] |= std::uint64_t(1) << (row & 63); }
+  };
+  
+  // A schema describes every option as constexpr data, so its lookup tables, short-flag table
+  // and help text are built by the compiler, and run() dispatches argv without allocating.
+  namespace schema
+  {
+    struct Option
+    {
+      std::string_view name;
+      std::string_view alias;
+      std::string_view metavar;
+      std::string_view help;
+      int expected_args = 0;
+      int priority = -1;
+      void (*apply)(ArgSpan) = nullptr;
+    };
+    
+    namespace detail
+    {
+      template<auto *Target, auto Restrict>
+      void apply_value(ArgSpan args)
+      {
+        using T = std::remove_pointer_t<decltype(Target)>;
+        T temp = utils::convert<T>(args[0]);
+        if constexpr (!std::is_null_pointer_v<decltype(Restrict)>)
+        {
+          if (!Restrict(temp))
+            utils::error("Invaild value '" + std::string(args[0]) + "'");
+        }
+        *Target = temp;
+      }
+      
+      template<bool *Target>
+      void apply_flag(ArgSpan)
+      {
+        *Target = true;
+      }
+      
+      constexpr std::uint64_t hash(std::string_view key)
+      {
+        std::uint64_t h = 14695981039346656037ull;
+        for (char c: key)
+        {
+          h ^= static_cast<unsigned char>(c);
+          h *= 1099511628211ull;
+        }
+        return h;
+      }
+      
+      constexpr std::size_t slot_count(std::size_t keys)
+      {
+        std::size_t n = 8;
+        while (n < keys * 2)
+          n *= 2;
+        return n;
+      }
+      
+      constexpr std::size_t display_size(const Option &option)
+      {
+        std::size_t n = 2 + (option.name.size() == 1 ? 1 : 2) + option.name.size();
+        if (!option.alias.empty())
+          n += 2 + (option.alias.size() == 1 ? 1 : 2) + option.alias.size();
+        if (option.expected_args != 0)
+          n += 3 + option.metavar.size();
+        return n;
+      }
+    }
+    
+    // Restrict is a function pointer 'bool (*)(T &)', or nullptr for no restriction.
+    template<auto *Target, auto Restrict = nullptr>
+    constexpr Option value(std::string_view name, std::string_view alias = {}, std::string_view help = {},
+                           int priority = -1)
+    {
+      using T = std::remove_pointer_t<decltype(Target)>;
+      return {name, alias, utils::type_name<T>, help, 1, priority, &detail::apply_value<Target, Restrict>};
+    }
+    
+    template<bool *Target>
+    constexpr Option flag(std::string_view name, std::string_view alias = {}, std::string_view help = {},
+                          int priority = -1)
+    {
+      return {name, alias, {}, help, 0, priority, &detail::apply_flag<Target>};
+    }
+    
+    constexpr Option cmd(std::string_view name, std::string_view alias, void (*func)(ArgSpan),
+                         int expected_args = -1, int priority = -1, std::string_view help = {})
+    {
+      return {name, alias, "args", help, expected_args, priority, func};
+    }
+    
+    template<std::size_t N>
+    class Table
+    {
+    private:
+      static constexpr std::uint16_t empty = 0xffff;
+      static_assert(N < empty, "Too many options in one schema.");
+      
+      std::array<Option, N> options{};
+      std::array<std::uint16_t, 256> shorts{};
+      std::array<std::uint16_t, detail::slot_count(2 * N)> slots{};
+      std::array<int, N> priorities{};
+      std::size_t priority_count = 0;
+    public:
+      constexpr explicit Table(const std::array<Option, N> &options_)
+          : options(options_)
+      {
+        for (auto &r: shorts)
+          r = empty;
+        for (auto &r: slots)
+          r = empty;
+        for (std::size_t i = 0; i < N; ++i)
+        {
+          insert(options[i].name, i);
+          if (!options[i].alias.empty())
+            insert(options[i].alias, i);
+          std::size_t p = 0;
+          while (p < priority_count && priorities[p] > options[i].priority)
+            ++p;
+          if (p < priority_count && priorities[p] == options[i].priority)
+            continue;
+          for (std::size_t j = priority_count; j > p; --j)
+            priorities[j] = priorities[j - 1];
+          priorities[p] = options[i].priority;
+          ++priority_count;
+        }
+      }
+      
+      constexpr std::size_t size() const { return N; }
+      
+      constexpr const Option *begin() const { return options.data(); }
+      
+      constexpr const Option *end() const { return options.data() + N; }
+      
+      constexpr const Option *find(std::string_view key) const
+      {
+        if (key.size() == 1)
+          return find_short(key[0]);
+        std::uint16_t i = slots[probe(key)];
+        return i == empty ? nullptr : &options[i];
+      }
+      
+      constexpr const Option *find_short(char c) const
+      {
+        std::uint16_t i = shorts[static_cast<unsigned char>(c)];
+        return i == empty ? nullptr : &options[i];
+      }
+      
+      // Checks every token first, then makes one pass over argv per distinct priority,
+      // so tasks run in priority order and in argv order within a priority. '--name=value'
+      // passes 'value' as the first argument, like CLI::parse(); '@file' words are not
+      // expanded, since this path reads argv in place.
+      void run(int argc, char **argv) const
+      {
+        for (std::size_t pass = 0; pass <= priority_count; ++pass)
+        {
+          int i = 1;
+          while (i < argc && !utils::is_option(argv[i]))
+            ++i;
+          while (i < argc)
+          {
+            std::string_view word = argv[i];
+            auto eq = utils::assignment(word);
+            std::string_view cmd = utils::strip(word.substr(0, eq));
+            const char *value = eq == std::string_view::npos ? nullptr : argv[i] + eq + 1;
+            int first = ++i;
+            while (i < argc && !utils::is_option(argv[i]))
+              ++i;
+            dispatch(cmd, value, argv + first, static_cast<std::size_t>(i - first), pass);
+          }
+        }
+      }
+    
+    private:
+      constexpr std::size_t probe(std::string_view key) const
+      {
+        std::size_t mask = slots.size() - 1;
+        for (std::size_t i = detail::hash(key) & mask;; i = (i + 1) & mask)
+        {
+          std::uint16_t s = slots[i];
+          if (s == empty || options[s].name == key || options[s].alias == key)
+            return i;
+        }
+      }
+      
+      constexpr void insert(std::string_view key, std::size_t option)
+      {
+        if (key.empty() || find(key) != nullptr)
+          throw std::logic_error("Duplicate or empty names are prohibited in a schema.");
+        if (key.size() == 1)
+          shorts[static_cast<unsigned char>(key[0])] = static_cast<std::uint16_t>(option);
+        slots[probe(key)] = static_cast<std::uint16_t>(option);
+      }
+      
+      bool is_multi(std::string_view cmd) const
+      {
+        return std::all_of(cmd.begin(), cmd.end(), [this](char c) { return find_short(c) != nullptr; });
+      }
+      
+      // 'value' is the part after '=', or nullptr.
+      void dispatch(std::string_view cmd, const char *value, char **args, std::size_t count, std::size_t pass) const
+      {
+        if (auto option = find(cmd))
+        {
+          invoke(*option, value, args, count, pass);
+          return;
+        }
+        if (is_multi(cmd))
+        {
+          for (char c: cmd)
+            invoke(*find_short(c), nullptr, nullptr, 0, pass);
+        }
+        else if (pass == 0)
+          utils::warn("Unrecognized option '" + std::string(cmd) + "'.");
+        if (pass == 0)
+        {
+          if (value != nullptr)
+            utils::warn("Discarded arguments '" + std::string(value) + "'");
+          for (std::size_t i = 0; i < count; ++i)
+            utils::warn("Discarded arguments '" + std::string(args[i]) + "'");
+        }
+      }
+      
+      void invoke(const Option &option, const char *value, char **args, std::size_t count, std::size_t pass) const
+      {
+        std::size_t total = count + (value != nullptr);
+        if (pass == 0)
+        {
+          utils::check_arity(option.name, total, option.expected_args);
+          return;
+        }
+        if (option.priority != priorities[pass - 1])
+          return;
+        std::array<std::string_view, 16> buffer;
+        std::vector<std::string_view> spill;
+        std::string_view *views = buffer.data();
+        if (total > buffer.size())
+        {
+          spill.resize(total);
+          views = spill.data();
+        }
+        std::size_t n = 0;
+        if (value != nullptr)
+          views[n++] = value;
+        for (std::size_t i = 0; i < count; ++i)
+          views[n++] = args[i];
+        option.apply(ArgSpan(views, total));
+      }
+    };
+    
+    template<typename... Options>
+    constexpr Table<sizeof...(Options)> make(const Options &... options)
+    {
+      return Table<sizeof...(Options)>({options...});
+    }
+    
+    template<std::size_t N>
+    constexpr std::size_t help_size(const Table<N> &table)
+    {
+      std::size_t width = 0;
+      for (auto &r: table)
+        width = std::max(width, detail::display_size(r));
+      std::size_t n = 0;
+      for (auto &r: table)
+        n += (r.help.empty() ? detail::display_size(r) : width + 2 + r.help.size()) + 1;
+      return n;
+    }
+    
+    namespace detail
+    {
+      template<std::size_t L>
+      struct Text
+      {
+        std::array<char, L + 1> data{};
+        std::size_t pos = 0;
+        
+        constexpr void append(std::string_view s)
+        {
+          for (char c: s)
+            data[pos++] = c;
+        }
+        
+        constexpr void append(char c, std::size_t n)
+        {
+          for (std::size_t i = 0; i < n; ++i)
+            data[pos++] = c;
+        }
+        
+        constexpr void append_name(std::string_view name)
+        {
+          append(name.size() == 1 ? "-" : "--");
+          append(name);
+        }
+      };
+      
+      template<const auto &S>
+      constexpr auto make_help()
+      {
+        Text<help_size(S)> text;
+        std::size_t width = 0;
+        for (auto &r: S)
+          width = std::max(width, display_size(r));
+        for (auto &r: S)
+        {
+          std::size_t begin = text.pos;
+          text.append("  ");
+          text.append_name(r.name);
+          if (!r.alias.empty())
+          {
+            text.append(", ");
+            text.append_name(r.alias);
+          }
+          if (r.expected_args != 0)
+          {
+            text.append(" <");
+            text.append(r.metavar);
+            text.append(">");
+          }
+          if (!r.help.empty())
+          {
+            text.append(' ', width - (text.pos - begin) + 2);
+            text.append(r.help);
+          }
+          text.append("\n");
+        }
+        return text.data;
+      }
+      
+      template<const auto &S>
+      inline constexpr auto help = make_help<S>();
+    }
+    
+    // The help text of a constexpr schema, e.g. 'ohcli::schema::help<my_schema>()'.
+    template<const auto &S>
+    constexpr std::string_view help()
+    {
+      return {detail::help<S>.data(), detail::help<S>.size() - 1};
+    }
+  }
+  
+  class CLI
+  {
+  private:
+    class Callback;
+    
+    class Registry;
+    
+    class Token
+    {
+    public:
+      std::string_view cmd;
+      std::size_t first;
+      std::size_t count;
+      const Callback *callback;
+    public:
+      Token(std::string_view cmd_, std::size_t first_, const Callback *callback_ = nullptr)
+          : cmd(cmd_), first(first_), count(0), callback(callback_) {}
+      
+      void add() { ++count; }
+      
+      std::uint32_t word() const { return static_cast<std::uint32_t>(first - 1); }
+    };
+    
+    class Packed
+    {
+    private:
+      const Callback *callback;
+      ArgSpan args;
+    public:
+      int priority;
+      // Index of 'priority' among the registered priorities, highest first.
+      std::uint32_t bucket;
+    public:
+      Packed() : callback(nullptr), priority(-1), bucket(0) {}
+      
+      Packed(const Callback *callback_, ArgSpan args_, int priority_, std::uint32_t bucket_)
+          : callback(callback_), args(args_), priority(priority_), bucket(bucket_) {}
+      
+      void operator()() const
+      {
+        callback->func(args);
+      }
+      
+      const Callback *target() const { return callback; }
+      
+      ArgSpan get_args() const { return args; }
+    };
+    
+    using Handler = utils::SmallFunction<void(ArgSpan)>;
+    
+    class Callback
+    {
+      friend class Packed;
+      friend class Registry;
+    private:
+      std::string name;
+      Handler func;
+      int expected_args;
+      int priority;
+      std::uint32_t index;
+      std::uint32_t bucket;
+      std::vector<std::uint32_t> deps;
+      utils::SmallFunction<Task(ArgSpan)> async;
+      StreamCmd stream;
+      std::size_t chunk;
+    public:
+      Callback(std::string name_, Handler func, int expected_args_, int priority_)
+          : name(std::move(name_)), func(std::move(func)), expected_args(expected_args_), priority(priority_),
+            index(0xffffffff), bucket(0), chunk(0) {}
+      
+      Callback() : func([](ArgSpan) {}), expected_args(-1), priority(-1), index(0xffffffff), bucket(0), chunk(0) {}
+      
+      const std::string &get_name() const { return name; }
+      
+      int get_priority() const { return priority; }
+      
+      int get_expected() const { return expected_args; }
+      
+      std::uint32_t get_index() const { return index; }
+      
+      const std::vector<std::uint32_t> &get_deps() const { return deps; }
+      
+      void add_dep(std::uint32_t dep) { deps.emplace_back(dep); }
+      
+      void set_stream(StreamCmd func_, std::size_t chunk_)
+      {
+        stream = std::move(func_);
+        chunk = chunk_ == 0 ? 1 : chunk_;
+      }
+      
+      bool is_stream() const { return static_cast<bool>(stream); }
+      
+      std::size_t get_chunk() const { return chunk; }
+      
+      void stream_chunk(ArgSpan args, bool last) const { stream(args, last); }
+      
+      template<typename F>
+      void set_async(F &&f) { async = std::forward<F>(f); }
+      
+      bool is_async() const { return static_cast<bool>(async); }
+      
+      Task start_async(ArgSpan args) const;
+      
+      std::optional<Diagnostic> check(std::uint32_t word, ArgSpan arg) const
+      {
+        return Diagnostic::arity(name, word, arg.size(), expected_args);
+      }
+      
+      Packed pack(ArgSpan arg) const
+      {
+        return {this, arg, priority, bucket};
+      }
+      
+      Packed pack(ArgSpan arg, std::uint32_t bucket_) const
+      {
+        return {this, arg, priority, bucket_};
+      }
+    };
+  
+    // Names and aliases share one open-addressing table that maps straight to the callback,
+    // and single-character names are also kept in a direct table for bundled short flags.
+    class Registry : public Suggester
+    {
+    private:
+      static constexpr std::uint32_t npos = 0xffffffff;
+      
+      struct Slot
+      {
+        std::uint64_t hash = 0;
+        std::uint32_t key = npos;
+        std::uint32_t callback = npos;
+      };
+      
+      // An order of the keys, built on first use and dropped by add(). Const callers
+      // racing to build it publish with a CAS, and the loser discards its copy.
+      class SortedKeys
+      {
+      private:
+        mutable std::atomic<const std::vector<std::uint32_t> *> order;
+      public:
+        SortedKeys() : order(nullptr) {}
+        
+        SortedKeys(SortedKeys &&rhs) noexcept : order(rhs.order.exchange(nullptr)) {}
+        
+        SortedKeys &operator=(SortedKeys &&rhs) noexcept
+        {
+          reset();
+          order.store(rhs.order.exchange(nullptr));
+          return *this;
+        }
+        
+        ~SortedKeys() { reset(); }
+        
+        void reset() { delete order.exchange(nullptr); }
+        
+        template<typename Less>
+        const std::vector<std::uint32_t> &get(const std::vector<std::string> &keys, Less less) const
+        {
+          if (auto p = order.load(std::memory_order_acquire))
+            return *p;
+          auto built = new std::vector<std::uint32_t>(keys.size());
+          for (std::uint32_t i = 0; i < keys.size(); ++i)
+            (*built)[i] = i;
+          std::sort(built->begin(), built->end(), [&keys, &less](auto a, auto b) { return less(keys[a], keys[b]); });
+          const std::vector<std::uint32_t> *expected = nullptr;
+          if (order.compare_exchange_strong(expected, built, std::memory_order_acq_rel))
+            return *built;
+          delete built;
+          return *expected;
+        }
+      };
+      
+      std::vector<Callback> callbacks;
+      std::vector<std::string> keys;
+      std::vector<std::uint32_t> owners;
+      SortedKeys sorted;
+      // By length, then lexicographic, for suggestions.
+      SortedKeys by_length;
+      std::vector<Slot> slots;
+      std::array<std::uint32_t, 256> shorts;
+      // Every distinct priority, highest first; -1 is always present for argv[0].
+      std::vector<int> priorities;
+    public:
+      Registry() : slots(16), priorities{-1} { shorts.fill(npos); }
+      
+      std::size_t size() const { return callbacks.size(); }
+      
+      std::size_t bucket_count() const { return priorities.size(); }
+      
+      std::uint32_t bucket_of(int priority) const
+      {
+        auto it = std::lower_bound(priorities.cbegin(), priorities.cend(), priority, std::greater<>());
+        return static_cast<std::uint32_t>(it - priorities.cbegin());
+      }
+      
+      const std::vector<int> &get_priorities() const { return priorities; }
+      
+      bool contains(std::string_view key) const { return find(key) != nullptr; }
+      
+      const Callback *find(std::string_view key) const
+      {
+        if (key.size() == 1)
+          return find_short(key[0]);
+        const Slot &slot = slots[probe(key, hash(key))];
+        return slot.callback == npos ? nullptr : &callbacks[slot.callback];
+      }
+      
+      const Callback *find_short(char c) const
+      {
+        std::uint32_t i = shorts[static_cast<unsigned char>(c)];
+        return i == npos ? nullptr : &callbacks[i];
+      }
+      
+      // Calls f(key, callback) for every key starting with 'prefix', in lexicographic order.
+      template<typename F>
+      void for_prefix(std::string_view prefix, F &&f) const
+      {
+        auto &order = sorted.get(keys, std::less<>());
+        auto it = std::lower_bound(order.cbegin(), order.cend(), prefix,
+                                   [this](std::uint32_t k, std::string_view p) { return std::string_view(keys[k]) < p; });
+        for (; it != order.cend() && std::string_view(keys[*it]).substr(0, prefix.size()) == prefix; ++it)
+          f(std::string_view(keys[*it]), callbacks[owners[*it]]);
+      }
+      
+      // The callback that every key starting with 'prefix' belongs to, or nullptr if there
+      // is none or more than one.
+      const Callback *find_prefix(std::string_view prefix) const
+      {
+        const Callback *found = nullptr;
+        bool ambiguous = false;
+        for_prefix(prefix, [&](std::string_view, const Callback &c)
+        {
+          if (found != nullptr && found != &c)
+            ambiguous = true;
+          found = &c;
+        });
+        return ambiguous ? nullptr : found;
+      }
+      
+      // The closest name within an edit distance of about a third of its length, written
+      // with dashes. Only names whose length is in reach are compared.
+      std::string suggest(std::string_view name) const override
+      {
+        // One or two characters are too short for a guess to mean anything.
+        std::size_t m = name.size();
+        if (m < 3 || m > 64)
+          return {};
+        std::size_t limit = m <= 4 ? 1 : m <= 8 ? 2 : 3;
+        std::array<std::uint64_t, 256> peq{};
+        for (std::size_t i = 0; i < m; ++i)
+          peq[static_cast<unsigned char>(name[i])] |= std::uint64_t(1) << i;
+        auto longer = [](const std::string &a, const std::string &b)
+        {
+          return a.size() != b.size() ? a.size() < b.size() : a < b;
+        };
+        auto &order = by_length.get(keys, longer);
+        auto it = std::lower_bound(order.cbegin(), order.cend(), m > limit ? m - limit : 1,
+                                   [this](std::uint32_t k, std::size_t len) { return keys[k].size() < len; });
+        const std::string *best = nullptr;
+        for (; it != order.cend() && keys[*it].size() <= m + limit; ++it)
+        {
+          auto d = utils::edit_distance(peq, m, keys[*it], limit);
+          if (d > limit)
+            continue;
+          // Later names must be strictly closer.
+          best = &keys[*it];
+          if (d <= 1)
+            break;
+          limit = d - 1;
+        }
+        if (best == nullptr)
+          return {};
+        return (best->size() == 1 ? "-" : "--") + *best;
+      }
+      
+      Callback &at(std::uint32_t index) { return callbacks[index]; }
+      
+      const Callback &at(std::uint32_t index) const { return callbacks[index]; }
+      
+      void add(Callback callback, const std::string &cmd, const std::string &alia = "")
+      {
+        if (contains(cmd))
+          utils::fatal("Duplicate names are prohibited.('" + cmd + "').");
+        if (!alia.empty() && (alia == cmd || contains(alia)))
+          utils::fatal("Duplicate names are prohibited.('" + alia + "').");
+        auto index = static_cast<std::uint32_t>(callbacks.size());
+        callback.index = index;
+        callbacks.emplace_back(std::move(callback));
+        auto bucket = bucket_of(callbacks.back().priority);
+        if (bucket == priorities.size() || priorities[bucket] != callbacks.back().priority)
+        {
+          priorities.insert(priorities.begin() + bucket, callbacks.back().priority);
+          for (auto &r: callbacks)
+            r.bucket = bucket_of(r.priority);
+        }
+        else
+          callbacks.back().bucket = bucket;
+        insert(cmd, index);
+        if (!alia.empty())
+          insert(alia, index);
+      }
+    
+    private:
+      static std::uint64_t hash(std::string_view key)
+      {
+        std::uint64_t h = 14695981039346656037ull;
+        for (unsigned char c: key)
+        {
+          h ^= c;
+          h *= 1099511628211ull;
+        }
+        return h;
+      }
+      
+      std::size_t probe(std::string_view key, std::uint64_t h) const
+      {
+        std::size_t mask = slots.size() - 1;
+        for (std::size_t i = h & mask;; i = (i + 1) & mask)
+        {
+          const Slot &slot = slots[i];
+          if (slot.callback == npos || (slot.hash == h && keys[slot.key] == key))
+            return i;
+        }
+      }
+      
+      void insert(const std::string &key, std::uint32_t callback)
+      {
+        if (key.size() == 1)
+          shorts[static_cast<unsigned char>(key[0])] = callback;
+        if ((keys.size() + 1) * 2 > slots.size())
+          rehash(slots.size() * 2);
+        auto h = hash(key);
+        Slot &slot = slots[probe(key, h)];
+        slot.hash = h;
+        slot.key = static_cast<std::uint32_t>(keys.size());
+        slot.callback = callback;
+        keys.emplace_back(key);
+        owners.emplace_back(callback);
+        sorted.reset();
+        by_length.reset();
+      }
+      
+      void rehash(std::size_t size)
+      {
+        std::vector<Slot> old(size);
+        old.swap(slots);
+        for (auto &r: old)
+        {
+          if (r.callback == npos)
+            continue;
+          std::size_t mask = slots.size() - 1;
+          std::size_t i = r.hash & mask;
+          while (slots[i].callback != npos)
+            i = (i + 1) & mask;
+          slots[i] = r;
+        }
+      }
+    };
+  
+  public:
+    // Everything one parse produces. The CLI itself is never modified by parsing into a
+    // ParseResult, so one fully registered CLI can be shared by any number of threads,
+    // each parsing into its own ParseResult.
+    class ParseResult
+    {
+      friend class CLI;
+    private:
+      std::pmr::vector<std::string_view> words;
+      std::pmr::vector<Token> tokens;
+      std::pmr::vector<Token> expanded;
+      std::pmr::vector<Packed> tasks;
+      std::pmr::vector<Packed> scheduled;
+      std::pmr::vector<std::size_t> offsets;
+      // The argv index of each word once response files or '--name=value' made the words
+      // differ from argv; empty while they are argv.
+      std::pmr::vector<std::uint32_t> origins;
+      std::pmr::deque<std::pmr::string> owned;
+      std::pmr::vector<utils::MappedFile> files;
+      Diagnostics *diagnostics;
+      Observer *observer;
+      bool parsed;
+    public:
+      // All per-parse storage comes from 'resource', e.g. a std::pmr::monotonic_buffer_resource
+      // that is released in one go once the result is no longer needed.
+      explicit ParseResult(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+          : words(resource), tokens(resource), expanded(resource), tasks(resource), scheduled(resource),
+            offsets(resource), origins(resource), owned(resource), files(resource), diagnostics(nullptr), observer(nullptr), parsed(false) {}
+      
+      std::pmr::memory_resource *resource() const { return words.get_allocator().resource(); }
+      
+      bool is_parsed() const { return parsed; }
+      
+      // Keeps the capacity of the buffers, so the next parse doesn't allocate them again.
+      ParseResult &reset()
+      {
+        words.clear();
+        tokens.clear();
+        expanded.clear();
+        tasks.clear();
+        scheduled.clear();
+        origins.clear();
+        owned.clear();
+        files.clear();
+        parsed = false;
+        return *this;
+      }
+      
+      ParseResult &run()
+      {
+        if (!parsed)
+          utils::fatal("Option has not parsed.");
+        for (auto &r: tasks)
+          invoke(r);
+        return *this;
+      }
+    
+      // Runs tasks of the same priority concurrently by handing them to 'executor', any callable
+      // taking a std::function<void()>, e.g. a thread pool's post(). Priorities act as barriers.
+      // Within a priority, a task waits for the tasks of the commands it depends on (see
+      // CLI::depends()) and for earlier tasks of its own command. The first exception thrown by
+      // a task is rethrown once its priority has drained, and the remaining tasks are skipped.
+      template<typename Executor>
+      ParseResult &run_parallel(Executor &&executor)
+      {
+        if (!parsed)
+          utils::fatal("Option has not parsed.");
+        for (std::size_t begin = 0, end = 0; begin < tasks.size(); begin = end)
+        {
+          while (end < tasks.size() && tasks[end].priority == tasks[begin].priority)
+            ++end;
+          run_level(begin, end, executor);
+        }
+        return *this;
+      }
+      
+      // Starts every task of a priority through 'executor' (e.g. posting to an event loop) and
+      // resumes once all of them, asynchronous commands included, have finished. Priorities
+      // act as barriers, and the first exception is rethrown once its priority has drained.
+      template<typename Executor>
+      Task run_async(Executor executor);
+    
+    private:
+      void invoke(const Packed &task) const
+      {
+        utils::Probe probe(observer);
+        task();
+        probe.lap([&task](Observer &o, std::chrono::nanoseconds t) { o.on_task(task.target()->get_name(), t); });
+      }
+      
+      std::string_view keep(std::string_view word)
+      {
+        return owned.emplace_back(word);
+      }
+      
+      struct Detached;
+      
+      template<typename Executor>
+      class Join;
+      
+      template<typename Executor>
+      void run_level(std::size_t begin, std::size_t end, Executor &executor)
+      {
+        struct Node
+        {
+          std::size_t pending = 0;
+          std::vector<std::size_t> next;
+        };
+        std::size_t n = end - begin;
+        std::vector<Node> nodes(n);
+        std::map<std::uint32_t, std::vector<std::size_t>> by_command;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+          auto &same = by_command[tasks[begin + i].target()->get_index()];
+          if (!same.empty())
+          {
+            nodes[same.back()].next.emplace_back(i);
+            ++nodes[i].pending;
+          }
+          same.emplace_back(i);
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+          for (auto dep: tasks[begin + i].target()->get_deps())
+          {
+            auto it = by_command.find(dep);
+            if (it == by_command.end())
+              continue;
+            for (auto j: it->second)
+            {
+              nodes[j].next.emplace_back(i);
+              ++nodes[i].pending;
+            }
+          }
+        }
+        
+        // Jobs only queue the tasks they make ready and this thread submits them, so an executor
+        // that runs jobs inline drains the level in a loop instead of recursing for every task.
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::size_t remaining = n;
+        std::exception_ptr error;
+        std::vector<std::size_t> ready;
+        auto run = [&](std::size_t i)
+        {
+          bool failed;
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            failed = error != nullptr;
+          }
+          if (!failed)
+          {
+            try
+            {
+              invoke(tasks[begin + i]);
+            }
+            catch (...)
+            {
+              std::lock_guard<std::mutex> lock(mutex);
+              if (!error)
+                error = std::current_exception();
+            }
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          for (auto next: nodes[i].next)
+          {
+            if (--nodes[next].pending == 0)
+              ready.emplace_back(next);
+          }
+          --remaining;
+          wake.notify_all();
+        };
+        for (std::size_t i = 0; i < n; ++i)
+        {
+          if (nodes[i].pending == 0)
+            ready.emplace_back(i);
+        }
+        std::vector<std::size_t> batch;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (remaining != 0)
+        {
+          wake.wait(lock, [&] { return !ready.empty() || remaining == 0; });
+          batch.swap(ready);
+          lock.unlock();
+          for (auto i: batch)
+            executor(std::function<void()>([&run, i] { run(i); }));
+          batch.clear();
+          lock.lock();
+        }
+        if (error)
+          std::rethrow_exception(error);
+      }
+      
+      ArgSpan args_of(const Token &token) const
+      {
+        return {words.data() + token.first, token.count};
+      }
+      
+      // The argv index to report for words[word].
+      std::uint32_t origin(std::size_t word) const
+      {
+        return word < origins.size() ? origins[word] : static_cast<std::uint32_t>(word);
+      }
+      
+      void report(const Diagnostic &d)
+      {
+        if (diagnostics != nullptr)
+          diagnostics->add(d);
+        else
+          utils::report(d);
+      }
+      
+      void discard(const Token &token)
+      {
+        for (std::size_t i = 0; i < token.count; ++i)
+        {
+          auto word = static_cast<std::uint32_t>(token.first + i);
+          report(Diagnostic(Diagnostic::Code::discarded_argument, origin(word), words[word]));
+        }
+      }
+    };
+  
+  private:
+    Registry registry;
+    Callback program;
+    std::optional<int> eager_priority;
+    bool response_files;
+    bool abbreviations;
+    std::optional<std::string> completion;
+    bool completing;
+    std::optional<std::string> env_prefix;
+    std::optional<utils::ConfigFile> config;
+    Observer *observer;
+    struct Subcommand
+    {
+      std::function<void(CLI &)> factory;
+      std::unique_ptr<CLI> cli;
+    };
+    std::map<std::string, Subcommand, std::less<>> subcommands;
+    // Clear the lazy values bound by add_value() when the CLI's own state starts over.
+    std::vector<std::function<void()>> lazies;
+    // The subcommand selected by the last parse, if any, and its name.
+    CLI *active;
+    std::string_view active_name;
+    std::optional<ParseResult> state;
+  public:
+    CLI() : response_files(false), abbreviations(false), completing(false), observer(nullptr), active(nullptr),
+            state(std::in_place) {}
+    
+    // 'obs' must outlive the parses and runs it observes; nullptr stops reporting.
+    CLI &set_observer(Observer *obs)
+    {
+      observer = obs;
+      return *this;
+    }
+    
+    CLI &add_cmd(const std::string &cmd, const SpanCmd &func, int expected_args = -1, int priority = -1)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_cmd() after parse().");
+      return add_handler(cmd, "", func, expected_args, priority);
+    }
+    
+    CLI &add_cmd(const std::string &cmd, const std::string &alia, const SpanCmd &func, int expected_args = -1,
+                 int priority = -1)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_cmd() after parse().");
+      return add_handler(cmd, alia, func, expected_args, priority);
+    }
+    
+    CLI &add_cmd(const std::string &cmd, const Cmd &func, int expected_args = -1, int priority = -1)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_cmd() after parse().");
+      return add_handler(cmd, "", legacy_handler(func), expected_args, priority);
+    }
+    
+    CLI &
+    add_cmd(const std::string &cmd, const std::string &alia, const Cmd &func, int expected_args = -1, int priority = -1)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_cmd() after parse().");
+      return add_handler(cmd, alia, legacy_handler(func), expected_args, priority);
+    }
+    
+    // Commands returning a Task run concurrently under run_async(); run() and run_parallel()
+    // drive them inline and fail if they suspend.
+    template<typename F, typename = std::enable_if_t<std::is_same_v<std::invoke_result_t<F &, ArgSpan>, Task>>>
+    CLI &add_cmd(const std::string &cmd, F func, int expected_args = -1, int priority = -1);
+    
+    template<typename F, typename = std::enable_if_t<std::is_same_v<std::invoke_result_t<F &, ArgSpan>, Task>>>
+    CLI &add_cmd(const std::string &cmd, const std::string &alia, F func, int expected_args = -1, int priority = -1);
+    
+    // When parsing a stream, 'func' gets the arguments of 'cmd' in chunks of up to 'chunk'
+    // while they are read, without keeping them. Stream commands run during parsing and
+    // ignore priorities; when parsing argv they get all their arguments in one call.
+    CLI &add_stream_cmd(const std::string &cmd, const StreamCmd &func, std::size_t chunk = 1024)
+    {
+      return add_stream_cmd(cmd, "", func, chunk);
+    }
+    
+    CLI &add_stream_cmd(const std::string &cmd, const std::string &alia, const StreamCmd &func,
+                        std::size_t chunk = 1024)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_cmd() after parse().");
+      add_handler(cmd, alia, [func](ArgSpan args) { func(args, true); }, -1, -1);
+      registry.at(registry.find(cmd)->get_index()).set_stream(func, chunk);
+      return *this;
+    }
+    
+    // Receives the positional arguments that precede the first option, like a stream command.
+    CLI &add_positional(const StreamCmd &func, std::size_t chunk = 1024)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_positional() after parse().");
+      program = Callback("", [func](ArgSpan args) { func(args, true); }, -1, -1);
+      program.set_stream(func, chunk);
+      return *this;
+    }
+    
+    template<std::size_t N>
+    CLI &add_schema(const schema::Table<N> &table)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_schema() after parse().");
+      for (auto &r: table)
+        add_handler(std::string(r.name), std::string(r.alias), r.apply, r.expected_args, r.priority);
+      return *this;
+    }
+    
+    // 'restrictor' is any callable taking T, e.g. range(), oneof(), regex() or a Restrictor<T>.
+    template<typename T, typename R = utils::Unrestricted,
+        typename = std::enable_if_t<std::is_invocable_r_v<bool, const R &, T &>>>
+    CLI &add_value(const std::string &name, T &value, R restrictor = R());
+    
+    template<typename T, typename R = utils::Unrestricted,
+        typename = std::enable_if_t<std::is_invocable_r_v<bool, const R &, T &>>>
+    CLI &add_value(const std::string &name, const std::string &alia, T &value, R restrictor = R());
+    
+    // Appends every argument of 'name' to 'values', converted in place after reserving room
+    // for all of them. With a 'delimiter' each argument is split on it as well, so
+    // '--ids=1,2,3' and '--ids 1 2 3' fill the vector alike; pass '\0' to not split.
+    template<typename T, typename R = utils::Unrestricted,
+        typename = std::enable_if_t<std::is_invocable_r_v<bool, const R &, T &>>>
+    CLI &add_values(const std::string &name, std::vector<T> &values, char delimiter = ',', R restrictor = R())
+    {
+      return add_values(name, "", values, delimiter, std::move(restrictor));
+    }
+    
+    template<typename T, typename R = utils::Unrestricted,
+        typename = std::enable_if_t<std::is_invocable_r_v<bool, const R &, T &>>>
+    CLI &add_values(const std::string &name, const std::string &alia, std::vector<T> &values, char delimiter = ',',
+                    R restrictor = R())
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_values() after parse().");
+      return add_handler(name, alia, values_handler(values, delimiter, std::move(restrictor)), -1, -1);
+    }
+    
+    // 'value' is set to the entry of 'choices' named by the argument.
+    template<typename E>
+    CLI &add_choice(const std::string &name, E &value, Choices<E> choices)
+    {
+      return add_choice(name, "", value, std::move(choices));
+    }
+    
+    template<typename E>
+    CLI &add_choice(const std::string &name, const std::string &alia, E &value, Choices<E> choices)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_choice() after parse().");
+      return add_handler(name, alia, [&value, choices = std::move(choices)](ArgSpan args)
+      {
+        auto found = choices.find(args[0]);
+        if (found == nullptr)
+          utils::error("Invaild value '" + std::string(args[0]) + "'");
+        value = *found;
+      }, 1, -1);
+    }
+    
+    // Only records the last occurrence; conversion and 'restrictor' run when 'value' is read.
+    template<typename T, typename R = utils::Unrestricted>
+    CLI &add_value(const std::string &name, lazy<T> &value, R restrictor = R())
+    {
+      return add_value(name, "", value, std::move(restrictor));
+    }
+    
+    template<typename T, typename R = utils::Unrestricted>
+    CLI &add_value(const std::string &name, const std::string &alia, lazy<T> &value, R restrictor = R())
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_value() after parse().");
+      if constexpr (!std::is_same_v<R, utils::Unrestricted>)
+        value.restrictor = std::move(restrictor);
+      lazies.emplace_back([&value] { value.clear(); });
+      return add_handler(name, alia, [&value](ArgSpan args) { value.set(args[0]); }, 1, -1);
+    }
+    
+    CLI &add_option(const std::string &name, bool &option)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_value() after parse().");
+      return add_handler(name, "", [&option](ArgSpan) { option = true; }, 0, -1);
+    }
+    
+    CLI &add_option(const std::string &name, const std::string &alia, bool &option)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_value() after parse().");
+      return add_handler(name, alia, [&option](ArgSpan) { option = true; }, 0, -1);
+    }
+    
+    // 'cmd' won't start in run_parallel() before every occurrence of 'on' of the same priority
+    // has finished. 'on' must not have a lower priority than 'cmd'.
+    CLI &depends(const std::string &cmd, const std::string &on)
+    {
+      if (state->parsed)
+        utils::fatal("Can not depends() after parse().");
+      auto callback = registry.find(cmd);
+      auto dep = registry.find(on);
+      if (callback == nullptr || dep == nullptr)
+        utils::fatal("Unknown command in depends('" + cmd + "', '" + on + "').");
+      if (dep->get_priority() < callback->get_priority())
+        utils::fatal("'" + on + "' has a lower priority than '" + cmd + "', so it always runs after it.");
+      if (dep == callback || reaches(*dep, callback->get_index()))
+        utils::fatal("Circular dependency between '" + cmd + "' and '" + on + "'.");
+      registry.at(callback->get_index()).add_dep(dep->get_index());
+      return *this;
+    }
+    
+    // Tasks with a priority of at least 'priority' run during parsing, in argv order, as soon
+    // as they are recognized, e.g. a '--config' that the remaining options depend on. They are
+    // not run again by run(). In try_parse() a runtime_error from one is recorded as an
+    // invalid_value diagnostic instead of being thrown. Only one registered priority may be that high, since a task of a
+    // lower one could otherwise run before a higher one that comes later in argv.
+    CLI &eager(int priority)
+    {
+      if (state->parsed)
+        utils::fatal("Can not eager() after parse().");
+      eager_priority = priority;
+      check_eager();
+      return *this;
+    }
+    
+    // When argv[1] is 'name', parse() hands the rest of argv to a child CLI instead, and run()
+    // runs that. The child is created and its options registered by 'factory' only when the
+    // subcommand is first selected, so unused modes cost nothing. Children can have
+    // subcommands of their own. Only parse() and try_parse() on the CLI's own state select
+    // subcommands.
+    CLI &add_subcommand(const std::string &name, std::function<void(CLI &)> factory)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_subcommand() after parse().");
+      if (!subcommands.emplace(name, Subcommand{std::move(factory), nullptr}).second)
+        utils::fatal("Duplicate names are prohibited.('" + name + "').");
+      return *this;
+    }
+    
+    // The subcommand selected by the last parse, or an empty view.
+    std::string_view get_subcommand() const { return active_name; }
+    
+    CLI *get_active() const { return active; }
+    
+    CLI &run()
+    {
+      if (active != nullptr)
+        active->run();
+      else
+        state->run();
+      return *this;
+    }
+    
+    template<typename Executor>
+    CLI &run_parallel(Executor &&executor)
+    {
+      if (active != nullptr)
+        active->run_parallel(std::forward<Executor>(executor));
+      else
+        state->run_parallel(std::forward<Executor>(executor));
+      return *this;
+    }
+    
+    template<typename Executor>
+    Task run_async(Executor executor);
+    
+    // Drops the state of the last parse but keeps the registered commands and the
+    // capacity of the per-parse buffers, so the next parse() doesn't allocate them again.
+    // If the last parse used a memory resource, its storage is handed back to it instead.
+    CLI &reset()
+    {
+      start_over();
+      state->reset();
+      return *this;
+    }
+    
+    // Tokens and arguments are views into argv, which must outlive run().
+    // Parsing again implies reset().
+    CLI &parse(int argc, char **argv)
+    {
+      return parse(argc, argv, std::pmr::get_default_resource());
+    }
+    
+    // Takes all per-parse storage from 'resource'. Handing the storage back needs the resource,
+    // so it must stay alive until reset(), the next parse into this CLI's own state with another
+    // resource (all other entry points, load_snapshot() included, use the default one) or the
+    // destruction of this CLI, e.g.
+    //   { std::pmr::monotonic_buffer_resource arena; cli.parse(argc, argv, &arena).run(); cli.reset(); }
+    CLI &parse(int argc, char **argv, std::pmr::memory_resource *resource)
+    {
+      start_over(resource);
+      if (complete_argv(argc, argv))
+        return *this;
+      if (auto sub = select(argc, argv))
+        sub->parse(argc - 1, argv + 1, resource);
+      else
+        parse(argc, argv, *state);
+      return *this;
+    }
+    
+    // '@path' words in argv are replaced by the words of that file, recursively. The file is
+    // mapped and unescaped in place, and stays mapped as long as the parse result. A path
+    // that can't be read is kept as an argument. Off by default, so programs taking literal
+    // '@word' arguments don't change behavior when such a file happens to exist.
+    CLI &expand_response_files(bool enable)
+    {
+      if (state->parsed)
+        utils::fatal("Can not expand_response_files() after parse().");
+      response_files = enable;
+      return *this;
+    }
+    
+    // Lets '--verb' stand for '--verbose' when no other name starts with 'verb'.
+    CLI &allow_abbreviations(bool enable)
+    {
+      if (state->parsed)
+        utils::fatal("Can not allow_abbreviations() after parse().");
+      abbreviations = enable;
+      return *this;
+    }
+    
+    // Makes 'prog --complete [subcommand...] <word>' print the completions of <word>, one per
+    // line, instead of parsing. Call it from the shell's completion function, e.g. for bash
+    //   COMPREPLY=($(prog --complete "${COMP_WORDS[@]:1:COMP_CWORD}"))
+    // and return early from main() when is_completing() is set after parse().
+    CLI &enable_completion(const std::string &flag = "complete")
+    {
+      if (state->parsed)
+        utils::fatal("Can not enable_completion() after parse().");
+      completion = "--" + flag;
+      return *this;
+    }
+    
+    bool is_completing() const { return completing; }
+    
+    // Names starting with 'word': options written with dashes when 'word' starts with '-',
+    // subcommands otherwise. Aliases are included.
+    std::vector<std::string> complete(std::string_view word) const
+    {
+      std::vector<std::string> ret;
+      if (word.empty() || word[0] != '-')
+      {
+        for (auto it = subcommands.lower_bound(word);
+             it != subcommands.end() && std::string_view(it->first).substr(0, word.size()) == word; ++it)
+          ret.emplace_back(it->first);
+        if (!word.empty())
+          return ret;
+      }
+      auto prefix = word;
+      if (!prefix.empty())
+        prefix.remove_prefix(prefix.size() > 1 && prefix[1] == '-' ? 2 : 1);
+      registry.for_prefix(prefix, [&ret](std::string_view key, const Callback &)
+      {
+        ret.emplace_back((key.size() == 1 ? "-" : "--") + std::string(key));
+      });
+      return ret;
+    }
+    
+    // Options missing from the command line are taken from the environment variable named
+    // 'prefix' + the option's name in upper case, '-' and '.' read as '_'. Options taking one
+    // argument get the whole value, others get it split like a response file; flags are
+    // set unless the value is empty, '0', 'false', 'no' or 'off'.
+    CLI &add_env(const std::string &prefix)
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_env() after parse().");
+      env_prefix = prefix;
+      return *this;
+    }
+    
+    // Options missing from the command line and the environment are taken from 'path', see
+    // utils::ConfigFile; each line counts as one occurrence. Names not registered by then
+    // are reported as unrecognized. With a 'cache' path, the parsed file is stored there in
+    // binary form and mapped by later starts while the file's size and mtime are unchanged.
+    // A missing file is ignored.
+    CLI &add_config(const std::string &path, const std::string &cache = "")
+    {
+      if (state->parsed)
+        utils::fatal("Can not add_config() after parse().");
+      config.emplace();
+      if (!config->open(path, cache))
+        config.reset();
+      return *this;
+    }
+    
+    // Reads whitespace-separated, optionally quoted words from 'in' as if they followed
+    // argv[0] = 'name'. Only the words of ordinary commands are kept until run(); the
+    // arguments of stream commands are handed over in chunks and dropped.
+    CLI &parse_stream(std::istream &in, std::string_view name = {})
+    {
+      start_over();
+      parse_stream(in, *state, name);
+      return *this;
+    }
+    
+    const CLI &parse_stream(std::istream &in, ParseResult &result, std::string_view name = {}) const
+    {
+      result.diagnostics = nullptr;
+      parse_source([&in](char *buf, std::size_t size) -> std::size_t
+                   {
+                     in.read(buf, static_cast<std::streamsize>(size));
+                     return static_cast<std::size_t>(in.gcount());
+                   }, name, result);
+      return *this;
+    }
+    
+    // Splits 'line' like parse_stream() does, e.g. a command received on a control socket.
+    CLI &parse_line(std::string_view line, std::string_view name = {})
+    {
+      start_over();
+      parse_line(line, *state, name);
+      return *this;
+    }
+    
+    const CLI &parse_line(std::string_view line, ParseResult &result, std::string_view name = {}) const
+    {
+      result.diagnostics = nullptr;
+      parse_source([&line](char *buf, std::size_t size) -> std::size_t
+                   {
+                     auto n = std::min(size, line.size());
+                     std::memcpy(buf, line.data(), n);
+                     line.remove_prefix(n);
+                     return n;
+                   }, name, result);
+      return *this;
+    }
+#ifdef OHCLI_POSIX
+    
+    CLI &parse_fd(int fd, std::string_view name = {})
+    {
+      start_over();
+      parse_fd(fd, *state, name);
+      return *this;
+    }
+    
+    const CLI &parse_fd(int fd, ParseResult &result, std::string_view name = {}) const
+    {
+      result.diagnostics = nullptr;
+      parse_source([fd](char *buf, std::size_t size) -> std::size_t
+                   {
+                     for (;;)
+                     {
+                       auto n = ::read(fd, buf, size);
+                       if (n >= 0)
+                         return static_cast<std::size_t>(n);
+                       if (errno != EINTR)
+                         utils::error(std::string("read() failed: ") + std::strerror(errno));
+                     }
+                   }, name, result);
+      return *this;
+    }
+#endif
+    
+    // Like parse(), but never throws or prints for problems in argv: they are recorded in
+    // 'diags' and formatted only when asked. Returns false if any of them is an error.
+    bool try_parse(int argc, char **argv, Diagnostics &diags)
+    {
+      start_over();
+      if (complete_argv(argc, argv))
+        return true;
+      if (auto sub = select(argc, argv))
+        return sub->try_parse(argc - 1, argv + 1, diags);
+      return try_parse(argc, argv, *state, diags);
+    }
+    
+    const CLI &parse(int argc, char **argv, ParseResult &result) const
+    {
+      result.diagnostics = nullptr;
+      parse_argv(argc, argv, result);
+      return *this;
+    }
+    
+    bool try_parse(int argc, char **argv, ParseResult &result, Diagnostics &diags) const
+    {
+      result.diagnostics = &diags;
+      parse_argv(argc, argv, result);
+      result.diagnostics = nullptr;
+      return !diags.has_errors();
+    }
+    
+    // Parses every row, a range of words starting with argv[0], into 'batch', which is
+    // resized to fit. Nothing is run: not even eager commands, and response files and
+    // fallbacks are not read. Like parse() into a ParseResult, the CLI is left untouched.
+    template<typename Rows>
+    const CLI &parse_batch(const Rows &rows, Batch &batch) const
+    {
+      batch.resize(static_cast<std::size_t>(std::distance(std::begin(rows), std::end(rows))));
+      return parse_batch(std::begin(rows), std::end(rows), batch, 0);
+    }
+    
+    // Fills the rows of an already sized 'batch' from 'first_row' on. Threads may parse
+    // disjoint slices of the same batch at once if each starts at a multiple of Batch::alignment.
+    template<typename It>
+    const CLI &parse_batch(It first, It last, Batch &batch, std::size_t first_row) const
+    {
+      if (first_row + static_cast<std::size_t>(std::distance(first, last)) > batch.size())
+        utils::fatal("The rows do not fit in the batch.");
+      std::vector<BatchColumn *> targets(registry.size(), nullptr);
+      for (auto &r: batch.columns)
+      {
+        auto callback = registry.find(r.first);
+        if (callback == nullptr)
+          utils::fatal("Unknown column '" + r.first + "'.");
+        if (targets[callback->get_index()] != nullptr)
+          utils::fatal("Duplicate columns are prohibited.('" + r.first + "').");
+        targets[callback->get_index()] = r.second.get();
+      }
+      // One scratch result for every row; reset() keeps its buffers.
+      ParseResult result;
+      Diagnostics diags(0);
+      result.diagnostics = &diags;
+      for (std::size_t row = first_row; first != last; ++first, ++row)
+      {
+        result.reset();
+        diags.clear();
+        for (auto &&word: *first)
+          result.words.emplace_back(word);
+        if (result.words.empty())
+        {
+          batch.reject(row);
+          continue;
+        }
+        tokenize(result);
+        parse_multi(result);
+        bool ok = true;
+        for (auto it = result.tokens.cbegin() + 1; it < result.tokens.cend(); ++it)
+        {
+          auto callback = it->callback;
+          auto args = result.args_of(*it);
+          if (callback == nullptr || callback->check(it->word(), args))
+          {
+            ok = false;
+            continue;
+          }
+          if (auto column = targets[callback->get_index()]; column != nullptr && !column->set(row, args))
+            ok = false;
+        }
+        if (!ok || !diags.empty())
+          batch.reject(row);
+      }
+      return *this;
+    }
+    
+    // Serializes the resolved tasks of the last parse and their arguments, so another process
+    // with the same registrations can load_snapshot() and run() them without parsing. Only
+    // words are stored, not typed results: the handlers of add_value() and lazy values convert
+    // them again in the loading process. Eager commands already ran and are left out, as are
+    // stream commands of parse_stream(), parse_line() and parse_fd(), which got their arguments
+    // while reading; after an argv parse, stream commands are ordinary tasks and are included.
+    std::string snapshot() const
+    {
+      std::string ret;
+      write_snapshot(ret);
+      return ret;
+    }
+    
+    // Replaces the current parse. 'blob' must outlive run(); the arguments are views into it.
+    CLI &load_snapshot(std::string_view blob)
+    {
+      reset();
+      if (!read_snapshot(blob))
+        utils::error("Invalid or mismatched snapshot.");
+      return *this;
+    }
+#ifdef OHCLI_POSIX
+    
+    // Maps the snapshot in 'fd', e.g. a file or memfd written by the parent; the mapping is
+    // kept until reset() or the next parse.
+    CLI &load_snapshot(int fd)
+    {
+      utils::MappedFile file;
+      if (!file.open(fd))
+        utils::error(std::string("Can not map snapshot: ") + std::strerror(errno));
+      std::string_view blob(file.data(), file.size());
+      reset();
+      state->files.emplace_back(std::move(file));
+      if (!read_snapshot(blob))
+        utils::error("Invalid or mismatched snapshot.");
+      return *this;
+    }
+#endif
+    
+    // The arguments of the last occurrence of 'name' (or its alias) in 'result'.
+    std::optional<ArgSpan> get(const ParseResult &result, std::string_view name) const
+    {
+      auto callback = registry.find(name);
+      if (callback == nullptr || result.tokens.empty())
+        return std::nullopt;
+      for (auto it = result.tokens.crbegin(); it + 1 < result.tokens.crend(); ++it)
+      {
+        if (it->callback == callback)
+          return result.args_of(*it);
+      }
+      return std::nullopt;
+    }
+  
+  private:
+    struct SnapshotHeader
+    {
+      std::uint32_t magic;
+      std::uint32_t version;
+      std::uint64_t fingerprint;
+      // Length of the subcommand's name; its snapshot follows instead of our own tables.
+      std::uint32_t sub;
+      std::uint32_t words;
+      std::uint32_t tasks;
+      std::uint32_t blob;
+    };
+    
+    static constexpr std::uint32_t snapshot_magic = 0x5353484f;// "OHSS"
+    static constexpr std::uint32_t snapshot_version = 1;
+    
+    // Identifies the registrations, so a snapshot is only loaded by a matching CLI.
+    std::uint64_t fingerprint() const
+    {
+      std::uint64_t h = 14695981039346656037ull;
+      auto mix = [&h](std::uint64_t v)
+      {
+        for (int i = 0; i < 8; ++i, v >>= 8)
+        {
+          h ^= v & 0xff;
+          h *= 1099511628211ull;
+        }
+      };
+      mix(registry.size());
+      for (std::uint32_t i = 0; i < registry.size(); ++i)
+      {
+        auto &r = registry.at(i);
+        for (unsigned char c: r.get_name())
+          mix(c);
+        mix(static_cast<std::uint64_t>(r.get_expected()));
+        mix(static_cast<std::uint64_t>(r.get_priority()));
+      }
+      return h;
+    }
+    
+    void write_snapshot(std::string &out) const
+    {
+      if (!state->parsed)
+        utils::fatal("Option has not parsed.");
+      SnapshotHeader h{snapshot_magic, snapshot_version, fingerprint(), 0, 0, 0, 0};
+      if (active != nullptr)
+      {
+        h.sub = static_cast<std::uint32_t>(active_name.size());
+        out.append(reinterpret_cast<const char *>(&h), sizeof(h));
+        out.append(active_name);
+        active->write_snapshot(out);
+        return;
+      }
+      auto &words = state->words;
+      auto &tasks = state->tasks;
+      std::vector<std::uint32_t> tables;
+      tables.reserve(tasks.size() * 3 + words.size() * 2);
+      for (auto &r: tasks)
+      {
+        tables.emplace_back(r.target() == &program ? 0xffffffff : r.target()->get_index());
+        tables.emplace_back(static_cast<std::uint32_t>(r.get_args().begin() - words.data()));
+        tables.emplace_back(static_cast<std::uint32_t>(r.get_args().size()));
+      }
+      std::uint32_t offset = 0;
+      for (auto &r: words)
+      {
+        tables.emplace_back(offset);
+        tables.emplace_back(static_cast<std::uint32_t>(r.size()));
+        offset += static_cast<std::uint32_t>(r.size());
+      }
+      h.words = static_cast<std::uint32_t>(words.size());
+      h.tasks = static_cast<std::uint32_t>(tasks.size());
+      h.blob = offset;
+      out.reserve(out.size() + sizeof(h) + tables.size() * sizeof(std::uint32_t) + offset);
+      out.append(reinterpret_cast<const char *>(&h), sizeof(h));
+      out.append(reinterpret_cast<const char *>(tables.data()), tables.size() * sizeof(std::uint32_t));
+      for (auto &r: words)
+        out.append(r);
+    }
+    
+    bool read_snapshot(std::string_view blob)
+    {
+      SnapshotHeader h;
+      if (blob.size() < sizeof(h))
+        return false;
+      std::memcpy(&h, blob.data(), sizeof(h));
+      if (h.magic != snapshot_magic || h.version != snapshot_version || h.fingerprint != fingerprint())
+        return false;
+      blob.remove_prefix(sizeof(h));
+      if (h.sub != 0)
+      {
+        if (blob.size() < h.sub)
+          return false;
+        auto it = subcommands.find(blob.substr(0, h.sub));
+        if (it == subcommands.end())
+          return false;
+        if (!it->second.cli)
+        {
+          it->second.cli = std::make_unique<CLI>();
+          it->second.factory(*it->second.cli);
+        }
+        state->parsed = true;
+        active = it->second.cli.get();
+        active_name = it->first;
+        active->reset();
+        return active->read_snapshot(blob.substr(h.sub));
+      }
+      std::size_t tables = (std::size_t(h.tasks) * 3 + std::size_t(h.words) * 2) * sizeof(std::uint32_t);
+      if (blob.size() < tables || blob.size() - tables != h.blob)
+        return false;
+      const char *at = blob.data();
+      const char *text = blob.data() + tables;
+      auto u32 = [&at]
+      {
+        std::uint32_t v;
+        std::memcpy(&v, at, sizeof(v));
+        at += sizeof(v);
+        return v;
+      };
+      auto &words = state->words;
+      auto &tasks = state->tasks;
+      const char *task_table = at;
+      at += std::size_t(h.tasks) * 3 * sizeof(std::uint32_t);
+      words.reserve(h.words);
+      for (std::uint32_t i = 0; i < h.words; ++i)
+      {
+        auto offset = u32();
+        auto size = u32();
+        if (offset > h.blob || size > h.blob - offset)
+          return false;
+        words.emplace_back(text + offset, size);
+      }
+      at = task_table;
+      tasks.reserve(h.tasks);
+      for (std::uint32_t i = 0; i < h.tasks; ++i)
+      {
+        auto index = u32();
+        auto first = u32();
+        auto count = u32();
+        if (first > h.words || count > h.words - first || (index != 0xffffffff && index >= registry.size()))
+          return false;
+        ArgSpan args(words.data() + first, count);
+        if (index == 0xffffffff)
+          tasks.emplace_back(program.pack(args, registry.bucket_of(-1)));
+        else
+          tasks.emplace_back(registry.at(index).pack(args));
+      }
+      state->parsed = true;
+      return true;
+    }
+    
+    // Handles 'prog --complete [subcommand...] <word>'; returns false for any other argv.
+    bool complete_argv(int argc, char **argv)
+    {
+      completing = false;
+      if (!completion || argc < 2 || *completion != argv[1])
+        return false;
+      select(0, argv);
+      state->reset();
+      state->parsed = true;
+      completing = true;
+      CLI *cli = this;
+      int i = 2;
+      for (; i + 1 < argc; ++i)
+      {
+        auto it = cli->subcommands.find(std::string_view(argv[i]));
+        if (it == cli->subcommands.end())
+          break;
+        if (!it->second.cli)
+        {
+          it->second.cli = std::make_unique<CLI>();
+          it->second.factory(*it->second.cli);
+        }
+        cli = it->second.cli.get();
+      }
+      std::string out;
+      for (auto &r: cli->complete(i < argc ? argv[argc - 1] : ""))
+        (out += r) += '\n';
+      std::fwrite(out.data(), 1, out.size(), stdout);
+      return true;
+    }
+    
+    // Every entry point parsing into the CLI's own state starts here. The last subcommand and
+    // lazy values are dropped, and the state is moved to 'resource' before anything else
+    // allocates, so no parse keeps using the resource of an earlier one.
+    void start_over(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+    {
+      if (active != nullptr)
+        active->reset();
+      active = nullptr;
+      active_name = {};
+      if (state->resource() != resource)
+        state.emplace(resource);
+      for (auto &clear: lazies)
+        clear();
+    }
+    
+    // Resolves the subcommand named by argv[1], running its factory on first use. Selecting
+    // one leaves this CLI's own state parsed and empty.
+    CLI *select(int argc, char **argv)
+    {
+      if (active != nullptr)
+        active->reset();
+      active = nullptr;
+      active_name = {};
+      if (subcommands.empty() || argc < 2)
+        return nullptr;
+      auto it = subcommands.find(std::string_view(argv[1]));
+      if (it == subcommands.end())
+        return nullptr;
+      auto &sub = it->second;
+      if (!sub.cli)
+      {
+        sub.cli = std::make_unique<CLI>();
+        sub.factory(*sub.cli);
+      }
+      state->reset();
+      state->parsed = true;
+      active = sub.cli.get();
+      active_name = it->first;
+      return active;
+    }
+    
+    bool reaches(const Callback &from, std::uint32_t to) const
+    {
+      for (auto dep: from.get_deps())
+      {
+        if (dep == to || reaches(registry.at(dep), to))
+          return true;
+      }
+      return false;
+    }
+    
+    CLI &add_handler(const std::string &cmd, const std::string &alia, Handler func, int expected_args, int priority)
+    {
+      registry.add(Callback(cmd, std::move(func), expected_args, priority), cmd, alia);
+      return *this;
+    }
+    
+    static Handler legacy_handler(const Cmd &func)
+    {
+      return [func](ArgSpan args)
+      {
+        CmdArg arg = args.to_cmdarg();
+        func(arg);
+      };
+    }
+    
+    template<typename T, typename R>
+    static Handler value_handler(T &value, R restrictor)
+    {
+      return [&value, restrictor = std::move(restrictor)](ArgSpan args)
+      {
+        T temp = utils::convert<T>(args[0]);
+        if (!restrictor(temp))
+          utils::error("Invaild value '" + std::string(args[0]) + "'");
+        value = std::move(temp);
+      };
+    }
+    
+    template<typename T, typename R>
+    static Handler values_handler(std::vector<T> &values, char delimiter, R restrictor)
+    {
+      return [&values, delimiter, restrictor = std::move(restrictor)](ArgSpan args)
+      {
+        std::size_t count = args.size();
+        if (delimiter != '\0')
+          for (auto arg: args)
+            count += utils::count_char(arg.data(), arg.data() + arg.size(), delimiter);
+        values.reserve(values.size() + count);
+        auto add = [&](T &&value, std::string_view item)
+        {
+          if (!restrictor(value))
+            utils::error("Invaild value '" + std::string(item) + "'");
+          values.emplace_back(std::move(value));
+        };
+        for (auto arg: args)
+        {
+          if (delimiter == '\0')
+            add(utils::convert<T>(arg), arg);
+          else if (!arg.empty())
+            utils::for_each_item<T>(arg, delimiter, add);
+        }
+      };
+    }
+    
+    void parse_argv(int argc, char **argv, ParseResult &result) const
     {
-      throw std::logic_error("\033[31mFATAL: \033[0m" + str);
+      check_eager();
+      result.reset();
+      result.words.assign(argv, argv + argc);
+      if (response_files && std::any_of(argv + 1, argv + argc, [](const char *w) { return w[0] == '@' && w[1] != '\0'; }))
+        expand_responses(result);
+      parse_words(result);
     }
     
-    void error(const std::string &str)
+    void expand_responses(ParseResult &result) const
     {
-      throw std::runtime_error("\033[31mERROR: \033[0m" + str);
+      std::pmr::vector<std::string_view> argv(result.resource());
+      argv.swap(result.words);
+      result.words.emplace_back(argv[0]);
+      result.origins.emplace_back(0);
+      std::vector<utils::FileId> active;
+      for (std::size_t i = 1; i < argv.size(); ++i)
+        expand_response(argv[i], static_cast<std::uint32_t>(i), active, result);
     }
     
-    void warn(const std::string &str)
+    void expand_response(std::string_view word, std::uint32_t index, std::vector<utils::FileId> &active,
+                         ParseResult &result) const
     {
-      std::cout << "\033[33mWARNING: \033[0m" << str << std::endl;
+      utils::MappedFile file;
+      if (word.size() < 2 || word[0] != '@' || !file.open(std::string(word.substr(1))))
+      {
+        result.words.emplace_back(word);
+        result.origins.emplace_back(index);
+        return;
+      }
+      if (std::find(active.cbegin(), active.cend(), file.id()) != active.cend())
+      {
+        result.report(Diagnostic(Diagnostic::Code::recursive_response_file, index, word));
+        return;
+      }
+      active.emplace_back(file.id());
+      char *data = file.data();
+      std::size_t size = file.size();
+      // The mapping doesn't move with the MappedFile, so views into it stay valid.
+      result.files.emplace_back(std::move(file));
+      utils::split_words(data, data + size, [&](std::string_view w) { expand_response(w, index, active, result); });
+      active.pop_back();
     }
     
-    template<typename T>
-    T str_to(const std::string &s);
+    template<typename Read>
+    void parse_source(Read &&read, std::string_view name, ParseResult &result) const
+    {
+      check_eager();
+      result.reset();
+      auto &words = result.words;
+      words.emplace_back(result.keep(name));
+      const Callback *streaming = program.is_stream() ? &program : nullptr;
+      std::vector<std::string> chunk;
+      std::vector<std::string_view> views;
+      auto flush = [&](bool last)
+      {
+        views.assign(chunk.cbegin(), chunk.cend());
+        streaming->stream_chunk(ArgSpan(views.data(), views.size()), last);
+        chunk.clear();
+      };
+      auto emit = [&](std::string_view word)
+      {
+        if (utils::is_option(word))
+        {
+          if (streaming != nullptr)
+            flush(true);
+          auto eq = utils::assignment(word);
+          streaming = registry.find(utils::strip(word.substr(0, eq)));
+          if (streaming != nullptr && streaming->is_stream())
+          {
+            chunk.reserve(streaming->get_chunk());
+            if (eq != std::string_view::npos)
+              chunk.emplace_back(word.substr(eq + 1));
+            return;
+          }
+          streaming = nullptr;
+          words.emplace_back(result.keep(word));
+        }
+        else if (streaming != nullptr)
+        {
+          chunk.emplace_back(word);
+          if (chunk.size() == streaming->get_chunk())
+            flush(false);
+        }
+        else
+          words.emplace_back(result.keep(word));
+      };
+      utils::WordSplitter splitter;
+      std::vector<char> buffer(64 * 1024);
+      for (std::size_t n; (n = read(buffer.data(), buffer.size())) != 0;)
+        splitter.feed(buffer.data(), buffer.data() + n, emit);
+      splitter.finish(emit);
+      if (streaming != nullptr)
+        flush(true);
+      parse_words(result, true);
+    }
     
-    template<>
-    std::string str_to(const std::string &s)
+    // Tokenizes like parse_words(), splitting '--name=value' into two words. The value
+    // is always an argument, even if it starts with '-'.
+    static void split_assignments(ParseResult &result)
     {
-      return s;
+      auto &tokens = result.tokens;
+      std::pmr::vector<std::string_view> split(result.resource());
+      std::pmr::vector<std::uint32_t> origins(result.resource());
+      split.reserve(result.words.size() * 2);
+      origins.reserve(result.words.size() * 2);
+      split.emplace_back(result.words[0]);
+      origins.emplace_back(result.origin(0));
+      for (std::size_t i = 1; i < result.words.size(); i++)
+      {
+        std::string_view word = result.words[i];
+        if (!utils::is_option(word))
+        {
+          split.emplace_back(word);
+          origins.emplace_back(result.origin(i));
+          tokens.back().add();
+          continue;
+        }
+        auto eq = utils::assignment(word);
+        split.emplace_back(word.substr(0, eq));
+        origins.emplace_back(result.origin(i));
+        tokens.emplace_back(Token(utils::strip(split.back()), split.size()));
+        if (eq != std::string_view::npos)
+        {
+          split.emplace_back(word.substr(eq + 1));
+          origins.emplace_back(result.origin(i));
+          tokens.back().add();
+        }
+      }
+      result.words.swap(split);
+      result.origins.swap(origins);
     }
     
-    template<>
-    double str_to(const std::string &s)
+    // Splits the words into tokens: argv[0] with the positionals, then one per option.
+    static void tokenize(ParseResult &result)
     {
-      try
+      auto &words = result.words;
+      auto &tokens = result.tokens;
+      tokens.emplace_back(Token(words[0], 1));
+      if (std::any_of(words.cbegin() + 1, words.cend(),
+                      [](std::string_view w) { return utils::assignment(w) != std::string_view::npos; }))
       {
-        return std::stod(s);
+        split_assignments(result);
+        return;
       }
-      catch (...)
+      for (std::size_t i = 1; i < words.size(); i++)
       {
-        error("Unexpected conversion of '" + s + "' to double.");
+        std::string_view word = words[i];
+        if (utils::is_option(word))
+          tokens.emplace_back(Token(utils::strip(word), i + 1));
+        else
+          tokens.back().add();
       }
-      return 0;
     }
     
-    template<>
-    int str_to(const std::string &s)
+    void parse_words(ParseResult &result, bool streamed = false) const
     {
-      try
-      {
-        return std::stoi(s);
-      }
-      catch (...)
+      auto &words = result.words;
+      auto &tokens = result.tokens;
+      auto &tasks = result.tasks;
+      result.observer = observer;
+      utils::Probe probe(result.observer);
+      tokenize(result);
+      probe.phase(Observer::Phase::tokenize, words.size());
+      auto lookups = parse_multi(result);
+      probe.phase(Observer::Phase::expand, tokens.size());
+      probe.lap([lookups](Observer &o, std::chrono::nanoseconds) { o.on_lookups(lookups); });
+      if (env_prefix || config)
+        add_fallbacks(result);
+      if (!streamed || !program.is_stream())
+        tasks.emplace_back(program.pack(result.args_of(tokens[0]), registry.bucket_of(-1)));
+      for (auto it = tokens.cbegin() + 1; it < tokens.cend(); ++it)
       {
-        error("Unexpected conversion of '" + s + "' to int.");
+        auto &r = *it;
+        if (auto callback = r.callback)
+        {
+          auto d = callback->check(result.origin(r.word()), result.args_of(r));
+          if (d)
+            result.report(*d);
+          if (d && d->is_error())
+            continue;
+          if (eager_priority && callback->get_priority() >= *eager_priority)
+            run_eager(*callback, r, result);
+          else
+            tasks.emplace_back(callback->pack(result.args_of(r)));
+          continue;
+        }
+        result.report(Diagnostic::unrecognized(result.origin(r.word()), r.cmd, &registry));
+        result.discard(r);
       }
-      return 0;
+      probe.phase(Observer::Phase::pack, tasks.size());
+      schedule(result);
+      probe.phase(Observer::Phase::schedule, tasks.size());
+      
+      result.parsed = true;
     }
     
-    template<>
-    long str_to(const std::string &s)
+    // try_parse() must not throw over argv, so there an error of the handler becomes a
+    // diagnostic; parse() lets it propagate like run() would.
+    static void run_eager(const Callback &callback, const Token &token, ParseResult &result)
     {
+      auto args = result.args_of(token);
+      if (result.diagnostics == nullptr)
+      {
+        callback.pack(args)();
+        return;
+      }
       try
       {
-        return std::stol(s);
+        callback.pack(args)();
       }
-      catch (...)
+      catch (std::runtime_error &)
       {
-        error("Unexpected conversion of '" + s + "' to long.");
+        result.report(Diagnostic(Diagnostic::Code::invalid_value, result.origin(token.word()),
+                                 args.empty() ? token.cmd : args[0]));
       }
-      return 0;
     }
     
-    template<>
-    long long str_to(const std::string &s)
+    static bool is_false(std::string_view value)
     {
-      try
+      return value.empty() || value == "0" || value == "false" || value == "no" || value == "off";
+    }
+    
+    // Appends a token for each option given only by the environment or the config file.
+    void add_fallbacks(ParseResult &result) const
+    {
+      auto &words = result.words;
+      auto &tokens = result.tokens;
+      std::vector<char> given(registry.size());
+      for (auto it = tokens.cbegin() + 1; it < tokens.cend(); ++it)
       {
-        return std::stoll(s);
+        if (it->callback != nullptr)
+          given[it->callback->get_index()] = 1;
       }
-      catch (...)
+      // Their words are not in argv, so origins is filled up to them and maps them to 'fallback'.
+      auto add_word = [&](std::string_view word)
+      {
+        for (auto i = result.origins.size(); i < words.size(); ++i)
+          result.origins.emplace_back(static_cast<std::uint32_t>(i));
+        words.emplace_back(word);
+        result.origins.emplace_back(Diagnostic::fallback);
+      };
+      auto option = [&](const Callback *callback, std::string_view name)
+      {
+        add_word(name);
+        tokens.emplace_back(Token(name, words.size(), callback));
+      };
+      if (env_prefix)
+      {
+        std::string var = *env_prefix;
+        for (std::uint32_t i = 0; i < registry.size(); ++i)
+        {
+          auto &callback = registry.at(i);
+          if (given[i] || callback.get_name().empty())
+            continue;
+          var.resize(env_prefix->size());
+          for (char c: callback.get_name())
+            var += (c == '-' || c == '.') ? '_' : static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+          const char *value = std::getenv(var.c_str());
+          if (value == nullptr)
+            continue;
+          given[i] = 1;
+          if (callback.get_expected() == 0)
+          {
+            if (!is_false(value))
+              option(&callback, callback.get_name());
+            continue;
+          }
+          option(&callback, callback.get_name());
+          if (callback.get_expected() == 1)
+          {
+            add_word(result.keep(value));
+            tokens.back().add();
+            continue;
+          }
+          auto &text = result.owned.emplace_back(value);
+          utils::split_words(text.data(), text.data() + text.size(), [&](std::string_view w)
+          {
+            add_word(w);
+            tokens.back().add();
+          });
+        }
+      }
+      if (!config)
+        return;
+      for (auto &r: config->get_entries())
       {
-        error("Unexpected conversion of '" + s + "' to long long.");
+        auto callback = registry.find(r.key);
+        if (callback == nullptr)
+        {
+          result.report(Diagnostic::unrecognized(Diagnostic::fallback, r.key, &registry));
+          continue;
+        }
+        if (given[callback->get_index()] == 1)
+          continue;
+        given[callback->get_index()] = 2;
+        if (callback->get_expected() == 0)
+        {
+          if (r.count == 0 || (r.count == 1 && !is_false(config->word(r.first))))
+            option(callback, r.key);
+          continue;
+        }
+        option(callback, r.key);
+        for (std::uint32_t i = 0; i < r.count; ++i)
+        {
+          add_word(config->word(r.first + i));
+          tokens.back().add();
+        }
       }
-      return 0;
     }
     
-    template<>
-    long double str_to(const std::string &s)
+    void check_eager() const
     {
-      try
+      auto &priorities = registry.get_priorities();
+      if (eager_priority && priorities.size() > 1 && priorities[1] >= *eager_priority)
+        utils::fatal("More than one priority is at least " + std::to_string(*eager_priority) + ".");
+    }
+    
+    // Tasks were appended in argv order; a counting sort over the priority buckets
+    // orders them by priority and keeps argv order within each priority.
+    void schedule(ParseResult &result) const
+    {
+      auto &tasks = result.tasks;
+      auto &offsets = result.offsets;
+      offsets.assign(registry.bucket_count() + 1, 0);
+      for (auto &r: tasks)
+        ++offsets[r.bucket + 1];
+      for (std::size_t i = 1; i < offsets.size(); ++i)
+        offsets[i] += offsets[i - 1];
+      result.scheduled.resize(tasks.size());
+      for (auto &r: tasks)
+        result.scheduled[offsets[r.bucket]++] = r;
+      tasks.swap(result.scheduled);
+    }
+    
+    // Resolves every token once and expands bundles like '-abc' in a single pass into a
+    // second token buffer, which is swapped in afterwards.
+    // Returns the number of registry lookups.
+    std::size_t parse_multi(ParseResult &result) const
+    {
+      auto &tokens = result.tokens;
+      auto &expanded = result.expanded;
+      expanded.clear();
+      expanded.reserve(tokens.size());
+      expanded.emplace_back(tokens[0]);
+      std::size_t lookups = tokens.size() - 1;
+      for (auto it = tokens.cbegin() + 1; it < tokens.cend(); ++it)
       {
-        return std::stold(s);
+        expanded.emplace_back(*it);
+        expanded.back().callback = registry.find(it->cmd);
+        if (expanded.back().callback == nullptr && abbreviations && it->cmd.size() > 1
+            && result.words[it->word()].substr(0, 2) == "--")
+        {
+          expanded.back().callback = registry.find_prefix(it->cmd);
+          ++lookups;
+        }
+        if (expanded.back().callback != nullptr || !is_multi(it->cmd))
+          continue;
+        expanded.pop_back();
+        for (std::size_t i = 0; i < it->cmd.size(); i++)
+          expanded.emplace_back(Token(it->cmd.substr(i, 1), it->first, registry.find_short(it->cmd[i])));
+        lookups += it->cmd.size();
+        result.discard(*it);
       }
-      catch (...)
+      tokens.swap(expanded);
+      return lookups;
+    }
+    
+    bool is_multi(std::string_view str) const
+    {
+      return std::all_of(str.begin(), str.end(), [this](char r) { return registry.find_short(r) != nullptr; });
+    }
+  };
+  
+  // Defined out of the class, so that the extern templates below aren't instantiated inline.
+  template<typename T, typename R, typename>
+  CLI &CLI::add_value(const std::string &name, T &value, R restrictor)
+  {
+    if (state->parsed)
+      utils::fatal("Can not add_value() after parse().");
+    return add_handler(name, "", value_handler(value, std::move(restrictor)), 1, -1);
+  }
+  
+  template<typename T, typename R, typename>
+  CLI &CLI::add_value(const std::string &name, const std::string &alia, T &value, R restrictor)
+  {
+    if (state->parsed)
+      utils::fatal("Can not add_value() after parse().");
+    return add_handler(name, alia, value_handler(value, std::move(restrictor)), 1, -1);
+  }
+#ifdef OHCLI_COROUTINES
+  
+  // The asynchronous members CLI declares for every translation unit.
+  struct CLI::ParseResult::Detached
+  {
+    struct promise_type
+    {
+      Detached get_return_object() { return {}; }
+      
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      
+      std::suspend_never final_suspend() noexcept { return {}; }
+      
+      void return_void() {}
+      
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+  
+  template<typename Executor>
+  class CLI::ParseResult::Join
+  {
+  private:
+    ParseResult &result;
+    std::size_t begin;
+    std::size_t end;
+    Executor &executor;
+    std::mutex mutex;
+    std::size_t remaining;
+    std::exception_ptr error;
+    std::coroutine_handle<> waiter;
+  public:
+    Join(ParseResult &result_, std::size_t begin_, std::size_t end_, Executor &executor_)
+        : result(result_), begin(begin_), end(end_), executor(executor_), remaining(0) {}
+    
+    bool await_ready() const noexcept { return begin == end; }
+    
+    // One extra reference is held until every task is submitted, so a level that finishes
+    // while we are still submitting doesn't resume the waiter from under us.
+    bool await_suspend(std::coroutine_handle<> h)
+    {
+      waiter = h;
+      remaining = end - begin + 1;
+      for (std::size_t i = begin; i < end; ++i)
+        executor(std::function<void()>([this, i] { start(result.tasks[i]); }));
+      return !release();
+    }
+    
+    void await_resume() const
+    {
+      if (error)
+        std::rethrow_exception(error);
+    }
+  
+  private:
+    bool release()
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      return --remaining == 0;
+    }
+    
+    void finish(std::exception_ptr e)
+    {
       {
-        error("Unexpected conversion of '" + s + "' to long double.");
+        std::lock_guard<std::mutex> lock(mutex);
+        if (e && !error)
+          error = e;
       }
-      return 0;
+      if (release())
+        waiter.resume();
     }
     
-    template<>
-    unsigned long str_to(const std::string &s)
+    void start(const Packed &task)
     {
+      if (task.target()->is_async())
+      {
+        std::exception_ptr e;
+        try
+        {
+          drive(task.target()->start_async(task.get_args()), this);
+          return;
+        }
+        catch (...)
+        {
+          e = std::current_exception();
+        }
+        finish(e);
+        return;
+      }
+      std::exception_ptr e;
       try
       {
-        return std::stoul(s);
+        result.invoke(task);
       }
       catch (...)
       {
-        error("Unexpected conversion of '" + s + "' to unsigned long.");
+        e = std::current_exception();
       }
-      return 0;
+      finish(e);
     }
     
-    template<>
-    unsigned long long str_to(const std::string &s)
+    static Detached drive(Task task, Join *join)
     {
+      std::exception_ptr e;
       try
       {
-        return std::stoull(s);
+        co_await task;
       }
       catch (...)
       {
-        error("Unexpected conversion of '" + s + "' to unsigned long long.");
+        e = std::current_exception();
       }
-      return 0;
+      join->finish(e);
     }
-    
-    template<>
-    bool str_to(const std::string &s)
+  };
+  
+  template<typename Executor>
+  Task CLI::ParseResult::run_async(Executor executor)
+  {
+    if (!parsed)
+      utils::fatal("Option has not parsed.");
+    for (std::size_t begin = 0, end = 0; begin < tasks.size(); begin = end)
     {
-      if (s == "true" || s == "True" || s == "TRUE")
-        return true;
-      else if (s == "false" || s == "False" || s == "FALSE")
-        return false;
-      else
-        error("Unexpected conversion of '" + s + "' to boolean.");
-      return true;
+      while (end < tasks.size() && tasks[end].priority == tasks[begin].priority)
+        ++end;
+      co_await Join<Executor>(*this, begin, end, executor);
     }
   }
-  class CLI
+  
+  inline Task CLI::Callback::start_async(ArgSpan args) const
+  {
+    return async(args);
+  }
+  
+  template<typename F, typename>
+  CLI &CLI::add_cmd(const std::string &cmd, F func, int expected_args, int priority)
+  {
+    return add_cmd(cmd, "", std::move(func), expected_args, priority);
+  }
+  
+  template<typename F, typename>
+  CLI &CLI::add_cmd(const std::string &cmd, const std::string &alia, F func, int expected_args, int priority)
+  {
+    if (state->parsed)
+      utils::fatal("Can not add_cmd() after parse().");
+    add_handler(cmd, alia, [func, cmd](ArgSpan args)
+    {
+      Task task = func(args);
+      task.start();
+      if (!task.done())
+        utils::fatal("'" + cmd + "' suspended outside run_async().");
+      task.get();
+    }, expected_args, priority);
+    registry.at(registry.find(cmd)->get_index()).set_async(std::move(func));
+    return *this;
+  }
+  
+  template<typename Executor>
+  Task CLI::run_async(Executor executor)
+  {
+    if (active != nullptr)
+      return active->run_async(std::move(executor));
+    return state->run_async(std::move(executor));
+  }
+#endif
+#ifndef OHCLI_HEADER_ONLY
+  
+#define OHCLI_EXTERN_ADD_VALUE(T) \
+  extern template CLI &CLI::add_value<T, utils::Unrestricted, void>( \
+      const std::string &, T &, utils::Unrestricted); \
+  extern template CLI &CLI::add_value<T, utils::Unrestricted, void>( \
+      const std::string &, const std::string &, T &, utils::Unrestricted);
+  OHCLI_EXPLICIT_TYPES(OHCLI_EXTERN_ADD_VALUE)
+#undef OHCLI_EXTERN_ADD_VALUE
+#endif
+  
+  using ParseResult = CLI::ParseResult;
+  
+  // Options of a long-running process that can change while it runs. Handlers are bound to
+  // draft(); reloads parse into it and publish a copy as a new immutable version. Readers
+  // get the current version with one atomic load, and old versions are freed once every
+  // Reader has passed quiescent() after they were replaced, as in quiescent-state RCU.
+  template<typename T>
+  class Live
   {
   private:
-    class Token
+    struct Version
     {
-    public:
-      std::string cmd;
-      std::vector<std::string> args;
-    public:
-      explicit Token(std::string arg, const std::initializer_list<std::string> &values_ = {})
-          : cmd(std::move(arg)), args(values_) {}
-      
-      void add(const std::string &v) { args.emplace_back(v); }
+      T value;
+      std::uint64_t number;
     };
     
-    class Packed
+    struct Slot
     {
-    private:
-      std::function<void()> packed;
-    public:
-      int priority;
-    public:
-      Packed(std::function<void()> packed, int priority_)
-          : packed(std::move(packed)), priority(priority_) {}
-      
-      void operator()()
-      {
-        packed();
-      }
+      std::atomic<std::uint64_t> seen{0};
+      bool used = false;
     };
     
-    class Callback
+    T initial;
+    T working;
+    std::atomic<const Version *> current;
+    std::atomic<bool> pending;
+    // Guards the draft, the retired versions and the reader slots; never taken by get().
+    std::mutex mutex;
+    std::vector<const Version *> retired;
+    std::deque<Slot> slots;
+  public:
+    // One per request thread; it must not outlive the Live.
+    class Reader
     {
     private:
-      std::string name;
-      Cmd func;
-      int expected_args;
-      int priority;
+      Live *live;
+      Slot *slot;
     public:
-      Callback(std::string name_, Cmd func, int expected_args_, int priority_)
-          : name(name_), func(std::move(func)), expected_args(expected_args_), priority(priority_) {}
+      explicit Reader(Live &live_) : live(&live_), slot(live_.attach()) {}
+      
+      Reader(const Reader &) = delete;
+      
+      Reader &operator=(const Reader &) = delete;
       
-      Callback() : func([](CmdArg) {}), expected_args(-1), priority(-1) {}
+      ~Reader() { live->detach(slot); }
       
-      Packed pack(CmdArg arg)
+      // Valid until this reader's next quiescent().
+      const T &get() const { return live->current.load(std::memory_order_acquire)->value; }
+      
+      const T &operator*() const { return get(); }
+      
+      const T *operator->() const { return &get(); }
+      
+      std::uint64_t version() const { return live->current.load(std::memory_order_acquire)->number; }
+      
+      // Declares that no reference from an earlier get() is still in use, e.g. between requests.
+      void quiescent()
       {
-        if (expected_args != -1)
-        {
-          if (arg.size() < expected_args)
-          {
-            utils::error(name + ": " + "Too few arguments (" + std::to_string(arg.size()) + "), expects "
-                         + std::to_string(expected_args));
-          }
-          if (arg.size() > expected_args)
-          {
-            utils::warn(name + ": " + "Expected " + std::to_string(expected_args) + " arguments, but "
-                        + std::to_string(arg.size()) + " was given.");
-          }
-        }
-        return {std::bind(func, arg), priority};
+        slot->seen.store(live->current.load(std::memory_order_acquire)->number, std::memory_order_release);
       }
     };
-  
-  private:
-    std::vector<Token> tokens;
-    std::map<const std::string, const std::string> alias;
-    std::map<const std::string, Callback> funcs;
-    std::vector<Packed> tasks;
-    bool parsed;
-  public:
-    CLI()
-        : parsed(false) {}
     
-    CLI &add_cmd(const std::string &cmd, const Cmd &func, int expected_args = -1, int priority = -1)
-    {
-      if (parsed)
-        utils::fatal("Can not add_cmd() after parse().");
-      if (funcs.find(cmd) != funcs.end())
-        utils::fatal("Duplicate names are prohibited.('" + cmd + "').");
-      funcs.insert(std::make_pair(cmd, Callback(cmd, func, expected_args, priority)));
-      return *this;
-    }
+    explicit Live(T initial_ = T())
+        : initial(initial_), working(initial_), current(new Version{std::move(initial_), 0}), pending(false) {}
     
-    CLI &
-    add_cmd(const std::string &cmd, const std::string &alia, const Cmd &func, int expected_args = -1, int priority = -1)
-    {
-      if (parsed)
-        utils::fatal("Can not add_cmd() after parse().");
-      if (funcs.find(cmd) != funcs.end())
-        utils::fatal("Duplicate names are prohibited.('" + cmd + "').");
-      if (alias.find(alia) != alias.end())
-        utils::fatal("Duplicate names are prohibited.('" + alia + "').");
-      funcs.insert(std::make_pair(cmd, Callback(cmd, func, expected_args, priority)));
-      alias.insert(std::make_pair(alia, cmd));
-      return *this;
-    }
+    Live(const Live &) = delete;
     
-    template<typename T>
-    CLI &add_value(const std::string &name, T &value, Restrictor<T> restrictor = default_restrictor<T>())
+    Live &operator=(const Live &) = delete;
+    
+    // Every Reader must be gone by now.
+    ~Live()
     {
-      if (parsed)
-        utils::fatal("Can not add_value() after parse().");
-      add_cmd(name,
-              [&value, restrictor](CmdArg &args)
-              {
-                T temp = utils::str_to<T>(args[0]);
-                if (!restrictor(temp))
-                  utils::error("Invaild value '" + args[0] + "'");
-                value = temp;
-              },
-              1);
-      return *this;
+      delete current.load();
+      for (auto r: retired)
+        delete r;
     }
     
-    template<typename T>
-    CLI &add_value(const std::string &name, const std::string &alia, T &value,
-                   Restrictor<T> restrictor = default_restrictor<T>())
+    // What handlers bind to, e.g. cli.add_value("level", live.draft().level). Only the
+    // thread that publishes may touch it.
+    T &draft() { return working; }
+    
+    // Publishes the draft as is, e.g. after the initial cli.parse(argc, argv).run().
+    std::uint64_t publish()
     {
-      if (parsed)
-        utils::fatal("Can not add_value() after parse().");
-      add_cmd(name, alia,
-              [&value, restrictor](CmdArg &args)
-              {
-                T temp = utils::str_to<T>(args[0]);
-                if (!restrictor(temp))
-                  utils::error("Invaild value '" + args[0] + "'");
-                value = temp;
-              },
-              1);
-      return *this;
+      std::lock_guard<std::mutex> lock(mutex);
+      return publish_locked();
     }
     
-    CLI &add_option(const std::string &name, bool &option)
+    // Parses 'line' on top of the current values and publishes the result, so "--level 3"
+    // changes only the level. If parsing or a handler throws, nothing is published.
+    std::uint64_t apply(const CLI &cli, std::string_view line)
     {
-      if (parsed)
-        utils::fatal("Can not add_value() after parse().");
-      add_cmd(name,
-              [&option](CmdArg &args)
-              {
-                option = true;
-              }, 0);
-      return *this;
+      std::lock_guard<std::mutex> lock(mutex);
+      return update(current.load(std::memory_order_relaxed)->value, [&](CLI::ParseResult &result)
+      {
+        cli.parse_line(line, result);
+      });
     }
     
-    CLI &add_option(const std::string &name, const std::string &alia, bool &option)
+    // Parses a whole command line again, starting from the initial values; response files
+    // and the environment are read anew.
+    std::uint64_t reload(const CLI &cli, int argc, char **argv)
     {
-      if (parsed)
-        utils::fatal("Can not add_value() after parse().");
-      add_cmd(name, alia,
-              [&option](CmdArg &args)
-              {
-                option = true;
-              }, 0);
-      return *this;
+      std::lock_guard<std::mutex> lock(mutex);
+      return update(initial, [&](CLI::ParseResult &result) { cli.parse(argc, argv, result); });
     }
     
-    CLI &run()
+    // Async-signal-safe, e.g. from a SIGHUP handler; the reload happens in poll().
+    void request_reload() noexcept { pending.store(true, std::memory_order_relaxed); }
+    
+    // Calls reload() if request_reload() was called since the last poll(); returns whether it did.
+    bool poll(const CLI &cli, int argc, char **argv)
     {
-      if (!parsed)
-        utils::fatal("Option has not parsed.");
-      for (auto &r: tasks)
-        r();
-      return *this;
+      if (!pending.exchange(false, std::memory_order_acquire))
+        return false;
+      reload(cli, argc, argv);
+      return true;
     }
     
-    CLI &parse(int argc, char **argv)
+    std::uint64_t version() const { return current.load(std::memory_order_acquire)->number; }
+  
+  private:
+    // Runs a parse into the draft, starting from 'base'. If it throws, the draft goes back to
+    // the current version, so a later publish() doesn't expose a half-applied update.
+    template<typename Parse>
+    std::uint64_t update(const T &base, Parse &&parse)
     {
-      tokens.emplace_back(Token(argv[0]));
-      for (int i = 1; i < argc; i++)
+      working = base;
+      try
       {
-        if (argv[i][0] == '-' && strlen(argv[i]) != 1)
-        {
-          if (argv[i][1] == '-' && strlen(argv[i]) != 2)
-            tokens.emplace_back(Token(std::string(std::string(argv[i]), 2)));//--x
-          else
-            tokens.emplace_back(Token(std::string(std::string(argv[i]), 1)));//-x
-        }
-        else
-          tokens.back().add(std::string(argv[i]));//-
+        CLI::ParseResult result;
+        parse(result);
+        result.run();
       }
-      funcs.insert(std::make_pair(argv[0], Callback()));
-      parse_multi();
-      for (auto &r: tokens)
+      catch (...)
       {
-        if (funcs.find(r.cmd) != funcs.cend())
-        {
-          tasks.emplace_back(funcs[r.cmd].pack(r.args));
-          continue;
-        }
-        if (alias.find(r.cmd) != alias.cend())
-        {
-          tasks.emplace_back(funcs[alias[r.cmd]].pack(r.args));
-          continue;
-        }
-        utils::warn("Unrecognized option '" + r.cmd + "'.");
-        for (auto &a: r.args)
-          utils::warn("Discarded arguments '" + a + "'");
+        working = current.load(std::memory_order_relaxed)->value;
+        throw;
       }
-      std::sort(tasks.begin(), tasks.end(),
-                [](const Packed &p1, const Packed &p2) { return p1.priority > p2.priority; });
-      
-      parsed = true;
-      return *this;
+      return publish_locked();
     }
-  
-  private:
-    void parse_multi()
+    
+    std::uint64_t publish_locked()
     {
-      for (auto it = tokens.cbegin(); it < tokens.cend(); it++)
+      auto old = current.load(std::memory_order_relaxed);
+      auto next = new Version{working, old->number + 1};
+      current.store(next, std::memory_order_release);
+      retired.emplace_back(old);
+      // A version is unreachable once every reader has seen a later one at a quiescent state.
+      std::uint64_t oldest = next->number;
+      for (auto &r: slots)
       {
-        if (is_multi(it->cmd))
-        {
-          for (std::size_t i = 0; i < it->cmd.size(); i++)
-            it = 1 + tokens.insert(it, Token(std::string(1, it->cmd[i])));
-          for (auto &r: it->args)
-            utils::warn("Discarded arguments '" + r + "'");
-          tokens.erase(it);
-        }
+        if (r.used)
+          oldest = std::min(oldest, r.seen.load(std::memory_order_acquire));
       }
+      auto kept = std::remove_if(retired.begin(), retired.end(), [oldest](const Version *v)
+      {
+        if (v->number >= oldest)
+          return false;
+        delete v;
+        return true;
+      });
+      retired.erase(kept, retired.end());
+      return next->number;
     }
     
-    bool is_multi(const std::string &str)
+    Slot *attach()
     {
-      if (funcs.find(str) != funcs.cend() || alias.find(str) != alias.cend())
-        return false;
-      return std::all_of(str.begin(), str.end(),
-                         [this](char r)
-                         {
-                           return !(funcs.find(std::string(1, r)) == funcs.cend() &&
-                                    alias.find(std::string(1, r)) == alias.cend());
-                         }
-      );
+      std::lock_guard<std::mutex> lock(mutex);
+      auto it = std::find_if(slots.begin(), slots.end(), [](const Slot &r) { return !r.used; });
+      Slot &slot = it == slots.end() ? slots.emplace_back() : *it;
+      slot.used = true;
+      slot.seen.store(current.load(std::memory_order_relaxed)->number, std::memory_order_relaxed);
+      return &slot;
+    }
+    
+    void detach(Slot *slot)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      slot->used = false;
     }
   };
 }
+#ifdef OHCLI_HEADER_ONLY
+#include "ohcli.cpp"
+#endif
 #endif
\ No newline at end of file